@@ -4,10 +4,46 @@
 
 using namespace file::listing;
 
+void Bucket::release_handle() {
+  /* reclaim and evict_bucket may race here */
+  void* h = handle.exchange(nullptr);
+  if (h) {
+    bc->handles.release(h);
+  }
+} /* release_handle */
+
+Bucket::~Bucket() {
+  /* recycled, or deleted without being reclaimed */
+  release_handle();
+  if (dfd != -1) {
+    close(dfd);
+  }
+} /* ~Bucket */
+
 bool Bucket::reclaim(const cohort::lru::ObjectFactory* newobj_fac) {
-    auto factory = dynamic_cast<const Bucket::Factory*>(newobj_fac);
-    if (factory == nullptr) {
-        return false;
+    /* we must hold our partition latch until our name is out of the
+     * tree and our watch and dbi are let go, or a new bucket of our name
+     * could lose them; no new object means the background evictor, which
+     * holds no partition latch--take ours, in lock order; otherwise the
+     * caller holds the latch of the new object's, which may be ours, and
+     * any other can only be tried */
+    bucket_avl_cache::Latch lat;
+    if (newobj_fac == nullptr) {
+      (void) bc->cache.find_latch(hk, name, lat, bucket_avl_cache::FLAG_LOCK);
+    } else {
+      auto fac = dynamic_cast<const Bucket::Factory*>(newobj_fac);
+      if (fac == nullptr) {
+	return false;
+      }
+      /* ours can't move while the caller holds it */
+      if (&(bc->cache.partition_of_scalar(hk)) != fac->latched) {
+	auto p = bc->cache.try_lock_partition(hk);
+	if (! p) {
+	  return false;
+	}
+	lat.p = p;
+	lat.lock = &p->lock;
+      }
     }
 #if 0
     /* make sure the reclaiming object is the same partiton with newobject factory,
@@ -20,10 +56,17 @@ bool Bucket::reclaim(const cohort::lru::ObjectFactory* newobj_fac) {
         return false;
     }
 #endif
+    /* stale notify handles first--this waits for a batch in progress,
+     * so must precede mtx */
+    release_handle();
     {
-      /* in this case, we are being called from a context which holds
-       * A partition lock, and this may be still in use */
-      lock_guard{mtx};
+      /* LATCHED (ours), and this may be still in use */
+      lock_guard guard{mtx};
+      /* the directory may be gone, and this may wait in the free pool */
+      if (dfd != -1) {
+	close(dfd);
+	dfd = -1;
+      }
       if (! deleted()) {
 	flags |= FLAG_DELETED;
 	bc->recycle_count++;
@@ -41,10 +84,13 @@ bool Bucket::reclaim(const cohort::lru::ObjectFactory* newobj_fac) {
 	bc->cache.remove(hk, this, bucket_avl_cache::FLAG_NONE);
 #endif
 
-	/* discard lmdb data associated with this bucket */
-	auto txn = env->getRWTransaction();
-	mdb_drop(*txn, dbi, 0); /* apparently, does not require commit */
+	/* discard lmdb data associated with this bucket, in the
+	 * background */
+	reclaimer->enqueue(dbi);
       } /* ! deleted */
     }
+    if (lat.lock) {
+      lat.lock->unlock();
+    }
     return true;
 } /* reclaim */
@@ -4,21 +4,29 @@
 #pragma once
 
 #include <iostream>
+#include <algorithm>
 #include <memory>
 #include <tuple>
 #include <vector>
+#include <array>
 #include <string>
 #include <string_view>
 #include <mutex>
 #include <shared_mutex>
 #include <condition_variable>
 #include <filesystem>
+#include <chrono>
+#include <deque>
+#include <thread>
 #include <boost/intrusive/avl_set.hpp>
 #include "function2.hpp"
+#include "unordered_dense.h"
 #include "cohort_lru.h"
 #include <lmdb-safe.hh>
 #include "notify.h"
+#include "tree_walk.h"
 #include <stdint.h>
+#include <string.h>
 #include <xxhash.h>
 
 #undef FMT_HEADER_ONLY
@@ -35,6 +43,424 @@ typedef bi::avl_set_member_hook<link_mode> member_hook_t;
 
 struct BucketCache;
 
+/* transparent string hash, for lookup by string_view */
+struct string_hash
+{
+  using is_transparent = void;
+  using is_avalanching = void;
+
+  uint64_t operator()(std::string_view sv) const noexcept {
+    return ankerl::unordered_dense::hash<std::string_view>{}(sv);
+  }
+};
+
+/* a materialized listing, produced once by the scan leading a flight and
+ * shared read-only by every lister that attached to it */
+struct ListPage
+{
+  uint64_t gen{0}; /* bucket generation the page is at least as new as */
+  std::string buf;
+  std::vector<std::pair<size_t, size_t>> ix; /* offset, length in buf */
+
+  void push_back(const std::string_view& k) {
+    ix.push_back({buf.size(), k.size()});
+    buf.append(k);
+  }
+
+  size_t size() const {
+    return ix.size();
+  }
+
+  std::string_view operator[](size_t n) const {
+    const auto& [off, len] = ix[n];
+    return std::string_view(buf.data() + off, len);
+  }
+}; /* ListPage */
+
+/* the listings of one marker in progress at one bucket generation; the
+ * first streams from its cursor as usual, and only one that arrives while
+ * it runs materializes a page, which any later identical listing waits
+ * for rather than walking the cursor again */
+struct ListFlight
+{
+  uint64_t gen;
+  std::shared_ptr<const ListPage> page;
+  uint32_t listers{1}; /* streaming, or building the page */
+  bool paging{false};
+  bool done{false};
+
+  explicit ListFlight(uint64_t gen) : gen(gen) {}
+}; /* ListFlight */
+
+/* a bounded log of the listing changes applied to the buckets of one lmdb
+ * environment, keyed by a sequence number assigned under the environment's
+ * (serialized) write txn; records are { type, bucket name length, bucket
+ * name, object name } */
+class Changelog
+{
+public:
+  /* bucket names are directory names, so they can't collide with this */
+  static constexpr const char* dbname = "/changelog";
+  static constexpr uint64_t trim_batch = 1024;
+
+  MDBDbi dbi;
+  /* sequences are drawn from one source shared by every env's log,
+   * seeded from the clock, so that none is reused across envs, reshape,
+   * recycle or restart */
+  std::atomic<uint64_t>& seq_src;
+  uint64_t next; /* last sequence assigned (under write txn) */
+  uint64_t size{0}; /* records retained (under write txn) */
+  std::atomic<uint64_t> committed; /* last sequence visible to readers */
+  std::atomic<uint64_t> low{1}; /* records before this are lost */
+
+  Changelog(std::shared_ptr<MDBEnv>& env, std::atomic<uint64_t>& seq_src)
+    : dbi(env->openDB(dbname, MDB_CREATE|MDB_INTEGERKEY)), seq_src(seq_src),
+      next(seq_src), committed(next)
+    {}
+
+  void append(MDBRWTransaction& txn, const std::string& bname,
+	      Notifiable::EventType type, const std::string_view& oname) {
+    uint16_t blen = bname.length();
+    std::string rec;
+    rec.reserve(sizeof(uint8_t) + sizeof(blen) + bname.length() +
+		oname.length());
+    rec.push_back(char(type));
+    rec.append(reinterpret_cast<const char*>(&blen), sizeof(blen));
+    rec.append(bname);
+    rec.append(oname);
+    next = ++seq_src;
+    txn->put(dbi, next, rec);
+    ++size;
+  }
+
+  /* a sequence with no record, after every one issued before, to base a
+   * (re)filled bucket's changes on (under write txn) */
+  uint64_t mark() {
+    return (next = ++seq_src);
+  }
+
+  /* drop the oldest records beyond the retention bound, a batch at a
+   * time; low is advanced before the txn commits, so a reader can only
+   * overestimate what has been lost */
+  void trim(MDBRWTransaction& txn, uint64_t max) {
+    if (size <= max) {
+      return;
+    }
+    uint64_t n = std::min(size - max, trim_batch);
+    uint64_t lo = low;
+    auto cursor = txn->getRWCursor(dbi);
+    MDBOutVal key, data;
+    MDBInVal k(lo);
+    int rc = cursor.lower_bound(k, key, data);
+    for (; (rc == 0) && (n > 0); --n, --size) {
+      lo = key.get<uint64_t>() + 1;
+      cursor.del();
+      rc = cursor.get(key, data, MDB_NEXT);
+    }
+    low = lo;
+  }
+
+  /* after commit of a txn whose last record was seq */
+  void publish(uint64_t seq) {
+    uint64_t c = committed;
+    while ((c < seq) &&
+	   (! committed.compare_exchange_weak(c, seq)))
+      ;
+  }
+
+  static void decode(const std::string_view& rec, Notifiable::EventType& type,
+		     std::string_view& bname, std::string_view& oname) {
+    uint16_t blen;
+    type = Notifiable::EventType(rec[0]);
+    memcpy(&blen, rec.data() + sizeof(uint8_t), sizeof(blen));
+    bname = rec.substr(sizeof(uint8_t) + sizeof(blen), blen);
+    oname = rec.substr(sizeof(uint8_t) + sizeof(blen) + blen);
+  }
+}; /* Changelog */
+
+/* empties the databases of buckets that have left the cache, on a thread
+ * of its own per env: at most batch deletes per committed write txn, with
+ * a pause between txns so notify writers on the env get their turn; the
+ * emptied (not deleted) database keeps its handle, which the next bucket
+ * of that name reopens */
+class Reclaimer
+{
+  using lock_guard = std::lock_guard<std::mutex>;
+  using unique_lock = std::unique_lock<std::mutex>;
+
+public:
+  std::atomic<uint32_t> batch{8192}; /* deletes per txn */
+  std::atomic<uint32_t> pause_us{1000}; /* between txns */
+  std::atomic<uint64_t> dropped{0}; /* databases emptied */
+  std::atomic<uint64_t> deleted{0}; /* entries deleted */
+
+private:
+  std::shared_ptr<MDBEnv> env;
+  std::mutex mtx;
+  std::condition_variable cv; /* work, or stop */
+  std::condition_variable idle_cv; /* active changed */
+  std::deque<MDBDbi> q;
+  bool busy{false};
+  bool cancelled{false}; /* the active one */
+  MDBDbi active;
+  bool stop{false};
+  std::thread thrd;
+
+  static bool same(const MDBDbi& lhs, const MDBDbi& rhs) {
+    return MDB_dbi(lhs) == MDB_dbi(rhs);
+  }
+
+  /* returns true once dbi is empty */
+  bool drop_some(const MDBDbi& dbi) {
+    auto txn = env->getRWTransaction();
+    uint32_t n{0};
+    int rc;
+    {
+      auto cursor = txn->getRWCursor(dbi);
+      MDBOutVal key, data;
+      rc = cursor.get(key, data, MDB_FIRST);
+      while ((rc == 0) && (n < batch)) {
+	cursor.del();
+	++n;
+	rc = cursor.get(key, data, MDB_NEXT);
+      }
+    }
+    bool done = (rc == MDB_NOTFOUND);
+    if (done) {
+      /* and the pages left behind */
+      mdb_drop(*txn, dbi, 0);
+    }
+    txn->commit();
+    deleted += n;
+    return done;
+  } /* drop_some */
+
+  void run() {
+    unique_lock lk{mtx};
+    for (;;) {
+      cv.wait(lk, [this]{ return stop || (! q.empty()); });
+      if (stop) {
+	/* whatever is left goes with the env, on restart */
+	break;
+      }
+      active = q.front();
+      q.pop_front();
+      busy = true;
+      cancelled = false;
+      lk.unlock();
+      bool done = drop_some(active);
+      lk.lock();
+      busy = false;
+      if (done) {
+	++dropped;
+      } else if ((! cancelled) &&
+		 (std::find_if(q.begin(), q.end(), [this](const auto& d) {
+		   return same(d, active); }) == q.end())) {
+	/* round-robin with the others */
+	q.push_back(active);
+      }
+      idle_cv.notify_all();
+      lk.unlock();
+      std::this_thread::sleep_for(std::chrono::microseconds(pause_us));
+      lk.lock();
+    }
+  } /* run */
+
+public:
+  Reclaimer(std::shared_ptr<MDBEnv>& env)
+    : env(env), thrd(&Reclaimer::run, this)
+    {}
+
+  ~Reclaimer() {
+    {
+      lock_guard guard{mtx};
+      stop = true;
+    }
+    cv.notify_one();
+    thrd.join();
+  }
+
+  /* a bucket left the cache with dbi */
+  void enqueue(const MDBDbi& dbi) {
+    {
+      lock_guard guard{mtx};
+      if (std::find_if(q.begin(), q.end(), [&dbi](const auto& d) {
+	    return same(d, dbi); }) != q.end()) {
+	return;
+      }
+      q.push_back(dbi);
+    }
+    cv.notify_one();
+  }
+
+  /* a bucket (re)opened dbi--it mustn't be emptied under it; waits for a
+   * txn in progress on it */
+  void cancel(const MDBDbi& dbi) {
+    unique_lock lk{mtx};
+    std::erase_if(q, [&dbi](const auto& d) { return same(d, dbi); });
+    if (busy && same(active, dbi)) {
+      cancelled = true;
+      idle_cv.wait(lk, [this, &dbi]{ return ! (busy && same(active, dbi)); });
+    }
+  }
+
+  size_t pending() {
+    lock_guard guard{mtx};
+    return q.size() + (busy ? 1 : 0);
+  }
+
+  /* until nothing is queued */
+  void drain() {
+    unique_lock lk{mtx};
+    idle_cv.wait(lk, [this]{ return q.empty() && (! busy); });
+  }
+}; /* Reclaimer */
+
+/* lmdb space in an env, in pages: the file holds used_pages, of which
+ * free_pages are on the freelist for reuse */
+struct EnvSpace
+{
+  uint64_t page_size{0};
+  uint64_t map_pages{0};
+  uint64_t used_pages{0};
+  uint64_t free_pages{0};
+};
+
+/* the value stored for an object in metadata mode (otherwise the value
+ * is the object's name) */
+struct ObjectMeta
+{
+  uint64_t size{0};
+  int64_t mtime{0}; /* ns */
+
+  static ObjectMeta of(const struct stat& st) {
+    return ObjectMeta{uint64_t(st.st_size),
+		      int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec};
+  }
+
+  std::string_view value() const {
+    return std::string_view(reinterpret_cast<const char*>(this), sizeof(*this));
+  }
+
+  static bool decode(const std::string_view& v, ObjectMeta& meta) {
+    if (v.size() != sizeof(ObjectMeta)) {
+      return false;
+    }
+    memcpy(&meta, v.data(), sizeof(ObjectMeta));
+    return true;
+  }
+}; /* ObjectMeta */
+
+struct Bucket;
+
+/* stable handles for the buckets being watched, passed to Notify as the
+ * watch opaque; a handle is { slot index, tag }, and the tag is bumped when
+ * the bucket is reclaimed, so events already queued for a recycled bucket
+ * resolve to nothing rather than to its new identity; slots are never
+ * freed, only reused */
+class BucketHandles
+{
+public:
+  static constexpr uint32_t chunk_shift = 10;
+  static constexpr uint32_t chunk_size = 1 << chunk_shift;
+  static constexpr uint32_t max_chunks = 4096;
+
+  struct Slot
+  {
+    std::mutex mtx; /* held by notify across a batch, orders before Bucket::mtx */
+    uint32_t tag{1};
+    Bucket* b{nullptr};
+  };
+
+private:
+  std::unique_ptr<std::atomic<Slot*>[]> chunks;
+  std::atomic<uint32_t> nslots{0};
+  std::mutex mtx;
+  std::vector<uint32_t> free_slots;
+
+  static void* encode(uint32_t ix, uint32_t tag) {
+    return reinterpret_cast<void*>((uint64_t(tag) << 32) | ix);
+  }
+
+  Slot& slot(uint32_t ix) {
+    return chunks[ix >> chunk_shift].load(std::memory_order_acquire)
+      [ix & (chunk_size - 1)];
+  }
+
+public:
+  BucketHandles()
+    : chunks(new std::atomic<Slot*>[max_chunks])
+    {
+      for (uint32_t ix = 0; ix < max_chunks; ++ix) {
+	chunks[ix].store(nullptr, std::memory_order_relaxed);
+      }
+    }
+
+  void* acquire(Bucket* b) {
+    uint32_t ix;
+    {
+      std::lock_guard guard{mtx};
+      if (! free_slots.empty()) {
+	ix = free_slots.back();
+	free_slots.pop_back();
+      } else {
+	ix = nslots;
+	if ((ix & (chunk_size - 1)) == 0) {
+	  if ((ix >> chunk_shift) >= max_chunks) [[unlikely]] {
+	    std::cerr << fmt::format("{} bucket handles exhausted", __func__)
+		      << std::endl;
+	    abort();
+	  }
+	  chunks[ix >> chunk_shift].store(new Slot[chunk_size],
+					  std::memory_order_release);
+	}
+	nslots = ix + 1;
+      }
+    }
+    auto& s = slot(ix);
+    std::lock_guard guard{s.mtx};
+    s.b = b;
+    return encode(ix, s.tag);
+  }
+
+  /* waits out a notify batch in progress on the bucket */
+  void release(void* h) {
+    auto ix = uint32_t(reinterpret_cast<uint64_t>(h));
+    {
+      auto& s = slot(ix);
+      std::lock_guard guard{s.mtx};
+      ++s.tag;
+      s.b = nullptr;
+    }
+    std::lock_guard guard{mtx};
+    free_slots.push_back(ix);
+  }
+
+  /* the bucket h refers to, with its slot locked in lk, or nullptr if h is
+   * stale */
+  Bucket* resolve(void* h, std::unique_lock<std::mutex>& lk) {
+    auto v = reinterpret_cast<uint64_t>(h);
+    auto ix = uint32_t(v);
+    if (ix >= nslots) [[unlikely]] {
+      return nullptr;
+    }
+    auto& s = slot(ix);
+    lk = std::unique_lock{s.mtx};
+    if ((s.tag != uint32_t(v >> 32)) ||
+	(! s.b)) {
+      lk.unlock();
+      return nullptr;
+    }
+    return s.b;
+  }
+
+  ~BucketHandles() {
+    for (uint32_t ix = 0; ix < max_chunks; ++ix) {
+      delete[] chunks[ix].load();
+    }
+  }
+}; /* BucketHandles */
+
 struct Bucket : public cohort::lru::Object
 {
   using lock_guard = std::lock_guard<std::mutex>;
@@ -46,11 +472,31 @@ struct Bucket : public cohort::lru::Object
   
   static constexpr uint64_t seed = 8675309;
 
+  /* how long a write-through waits for its inotify echo */
+  static constexpr std::chrono::seconds suppress_ttl{5};
+  static constexpr size_t suppress_sweep = 4096;
+
+  /* a change the application wrote through, whose echo is to be ignored */
+  struct Suppression
+  {
+    Notifiable::EventType type;
+    uint64_t gen; /* generation the write-through produced */
+    std::chrono::steady_clock::time_point expire;
+  };
+
+  using suppress_map_t =
+    ankerl::unordered_dense::map<std::string, std::vector<Suppression>,
+				 string_hash, std::equal_to<>>;
+
   BucketCache* bc;
   std::string name;
   std::shared_ptr<MDBEnv> env;
   MDBDbi dbi;
+  Changelog* clog;
+  Reclaimer* reclaimer;
   uint64_t hk;
+  std::atomic<void*> handle; /* watch opaque, see BucketHandles */
+  int dfd; /* the bucket directory, for fstatat (metadata mode) */
   member_hook_t name_hook;
 
   // XXX clean this up
@@ -58,19 +504,88 @@ struct Bucket : public cohort::lru::Object
   std::condition_variable cv;
   uint32_t flags;
 
+  /* bumped after fill and after each committed notify batch, so a listing
+   * which read gen before opening its txn is at least that new */
+  std::atomic<uint64_t> gen;
+  uint64_t fill_gen{0}; /* gen as of the last fill (LOCKED) */
+
+  /* changelog sequence marked by the last fill--later changes to this
+   * bucket are all logged after it, and every sequence issued before it
+   * is stale */
+  uint64_t log_base;
+
+  /* write-throughs awaiting their echo, by name, oldest first (LOCKED) */
+  suppress_map_t suppress;
+
+  /* listings in progress, by marker (LOCKED) */
+  ankerl::unordered_dense::map<std::string, std::shared_ptr<ListFlight>> flights;
+
+  /* steady_clock time of the last get_bucket, while idle expiry is on
+   * (see BucketCache::set_idle_ttl) */
+  std::atomic<std::chrono::steady_clock::rep> atime{0};
+
 public:
   Bucket(BucketCache* bc, const std::string& name, uint64_t hk)
-    : bc(bc), name(name), hk(hk), flags(FLAG_NONE) {}
+    : bc(bc), name(name), clog(nullptr), reclaimer(nullptr), hk(hk), handle(nullptr), dfd(-1),
+      flags(FLAG_NONE), gen(0), log_base(0) {}
 
-  void set_env(std::shared_ptr<MDBEnv>& _env, MDBDbi& _dbi) {
+  ~Bucket() override;
+
+  void set_env(std::shared_ptr<MDBEnv>& _env, MDBDbi& _dbi, Changelog* _clog,
+	       Reclaimer* _reclaimer) {
     env = _env;
     dbi = _dbi;
+    clog = _clog;
+    reclaimer = _reclaimer;
   }
 
   inline bool deleted() const {
     return flags & FLAG_DELETED;
   }
 
+  /* expect an echo of a write-through (LOCKED) */
+  void suppress_echo(Notifiable::EventType type, const std::string& oname,
+		     uint64_t _gen, std::chrono::steady_clock::time_point now) {
+    if (suppress.size() > suppress_sweep) [[unlikely]] {
+      std::erase_if(suppress, [now](const auto& elt) {
+	return elt.second.back().expire < now;
+      });
+    }
+    suppress[oname].push_back(Suppression{type, _gen, now + suppress_ttl});
+  }
+
+  /* true if ev is the echo of a write-through, which is consumed (LOCKED);
+   * the expected changes to a name alternate ADD and REMOVE, so an event
+   * of the other type means the expectations are stale and they are
+   * discarded, as are those of a generation before the bucket's last
+   * (re)fill, which listed their changes already */
+  bool suppressed(const Notifiable::Event& ev,
+		  std::chrono::steady_clock::time_point now) {
+    if ((! ev.name) ||
+	(ev.type == Notifiable::EventType::UPDATE) /* not an expectation */) {
+      return false;
+    }
+    auto it = suppress.find(*ev.name);
+    if (it == suppress.end()) {
+      return false;
+    }
+    auto& q = it->second;
+    auto live = std::find_if(q.begin(), q.end(), [this, now](const auto& sup) {
+      return (sup.expire >= now) && (sup.gen > fill_gen);
+    });
+    q.erase(q.begin(), live);
+    bool match = (! q.empty()) && (q.front().type == ev.type);
+    if (match) {
+      q.erase(q.begin());
+    } else {
+      q.clear();
+    }
+    if (q.empty()) {
+      suppress.erase(it);
+    }
+    return match;
+  }
+
   class Factory : public cohort::lru::ObjectFactory
   {
   public:
@@ -78,6 +593,9 @@ public:
     const std::string& name;
     uint64_t hk;
     uint32_t flags;
+    /* the partition (bucket_avl_cache::Partition) the caller holds
+     * latched across lru insert, see reclaim */
+    const void* latched{nullptr};
 
     Factory() = delete;
     Factory(BucketCache *bc, const std::string& name)
@@ -95,6 +613,10 @@ public:
     cohort::lru::Object* alloc() override {
       return new Bucket(bc, name, hk);
     }
+
+    uint64_t hash() const override {
+      return hk;
+    }
   }; /* Factory */
 
   struct BucketLT
@@ -131,19 +653,78 @@ public:
 			     std::mutex> bucket_avl_cache;
 
   bool reclaim(const cohort::lru::ObjectFactory* newobj_fac);
+  void release_handle();
 
 }; /* Bucket */
 
+/* buckets kept out of eviction (see BucketCache::pin_bucket) */
+struct PinConfig
+{
+  uint32_t budget{0}; /* most pinned at once */
+  std::vector<std::string> buckets; /* pinned at startup */
+}; /* PinConfig */
+
 struct BucketCache : public Notifiable
 {
   using lock_guard = std::lock_guard<std::mutex>;
   using unique_lock = std::unique_lock<std::mutex>;
 
   std::string bucket_root;
-  uint32_t max_buckets;
+  std::atomic<uint32_t> max_buckets; /* see set_autosize */
+  bool recursive; /* objects keyed by path within the bucket */
+  bool metadata; /* values are ObjectMeta */
   std::atomic<uint64_t> recycle_count;
-  std::unique_ptr<Notify> un;
+  std::atomic<uint64_t> coalesce_count;
+  std::atomic<uint64_t> evict_count{0}; /* buckets removed under us */
+  std::atomic<uint64_t> gen_seq;
+  std::atomic<uint64_t> changelog_max{1 << 20}; /* records per env */
+  std::atomic<uint32_t> fill_threads{1}; /* scanners walking a bucket in fill */
+  std::atomic<uint32_t> fill_inflight{0}; /* directory reads at once, 0 for fill_threads */
+  std::atomic<uint64_t> fill_count{0};
+  std::atomic<uint64_t> fill_us{0}; /* total time in fill */
+  TreeWalk::Pool scan_pool; /* fill_threads past each filler's own */
+  BucketHandles handles;
   std::mutex mtx;
+
+  /* background reclaim keeps lru headroom between these (see
+   * set_headroom), so a miss needn't reclaim inline */
+  std::atomic<uint32_t> headroom_lowat{0};
+  std::atomic<uint32_t> headroom_hiwat{0};
+  std::atomic<uint64_t> prereclaim_count{0};
+  std::thread evictor;
+  std::mutex evictor_mtx;
+  std::condition_variable evictor_cv;
+  bool evictor_stop{false};
+  static constexpr std::chrono::milliseconds evictor_interval{100};
+
+  /* sizing max_buckets from the lru miss curve (see set_autosize) */
+  struct AutoSize
+  {
+    uint32_t min{0};
+    uint32_t max{0}; /* 0 for off */
+    std::chrono::milliseconds interval{10000};
+    uint64_t samples{1000}; /* accesses before a decision */
+    double grow_gain{0.01}; /* miss ratio saved per step, to grow */
+    double shrink_gain{0.001}; /* ...by all the history reaches, or shrink */
+  };
+  AutoSize autosize; /* evictor_mtx */
+  std::atomic<uint64_t> resize_count{0};
+
+  std::mutex reshape_mtx; /* see reshape */
+
+  /* idle expiry (see set_idle_ttl): bucket names are filed in the slot
+   * for when they would expire, each slot wheel_tick wide */
+  static constexpr uint32_t wheel_slots = 64;
+  std::atomic<bool> idle_expiry{false};
+  std::mutex wheel_mtx;
+  std::chrono::milliseconds idle_ttl{0}; /* wheel_mtx */
+  std::chrono::milliseconds wheel_tick{0}; /* wheel_mtx */
+  uint64_t wheel_epoch{0}; /* wheel_mtx, bumped by set_idle_ttl */
+  /* the start of the next slot due (wheel_mtx) */
+  std::chrono::steady_clock::time_point wheel_time;
+  std::vector<std::vector<std::string>> wheel; /* wheel_mtx */
+  ankerl::unordered_dense::set<std::string> wheeled; /* wheel_mtx */
+  std::atomic<uint64_t> expire_count{0};
   
 
   /* the bucket lru cache keeps track of the buckets whose listings are
@@ -156,18 +737,37 @@ struct BucketCache : public Notifiable
    * each supports 1 rw and unlimited ro transactions;  the materialized
    * listing for each bucket is stored as a database in one of these
    * environments, selected by a hash of the bucket name; a bucket's database
-   * is dropped/cleared whenever its entry is reclaimed from cache; the entire
+   * is dropped/cleared whenever its entry is reclaimed from cache; each
+   * environment also holds the changelog for its buckets; the entire
    * complex is cleared on restart to preserve consistency */
   class Lmdbs
   {
     std::string database_root;
-    uint8_t lmdb_count;
-    std::vector<std::shared_ptr<MDBEnv>> envs;
+    std::atomic<uint8_t> lmdb_count; /* new buckets are placed among these */
+    std::atomic<uint8_t> n_envs; /* open, see set_count */
+    /* a slot for every count, filled before n_envs (and lmdb_count) is
+     * raised past it, so readers never see one change */
+    std::array<std::shared_ptr<MDBEnv>, UINT8_MAX> envs;
+    std::array<std::unique_ptr<Changelog>, UINT8_MAX> logs;
+    std::array<std::unique_ptr<Reclaimer>, UINT8_MAX> reclaimers; /* before the envs go */
+    std::atomic<uint64_t> log_seq; /* see Changelog */
     sf::path dbp;
 
+    void open_env(int ix) {
+      sf::path env_path{dbp / fmt::format("part_{}", ix)};
+      sf::create_directory(env_path);
+      auto env = getMDBEnv(env_path.string().c_str(), 0 /* flags? */, 0600);
+      envs[ix] = env;
+      logs[ix] = std::make_unique<Changelog>(env, log_seq);
+      reclaimers[ix] = std::make_unique<Reclaimer>(env);
+      n_envs.store(ix + 1, std::memory_order_release);
+    }
+
   public:
     Lmdbs(std::string& database_root, uint8_t lmdb_count)
-      : database_root(database_root), lmdb_count(lmdb_count),
+      : database_root(database_root), lmdb_count(lmdb_count), n_envs(0),
+        log_seq(std::chrono::duration_cast<std::chrono::nanoseconds>(
+		  std::chrono::system_clock::now().time_since_epoch()).count()),
         dbp(database_root) {
       /* purge cache completely */
       for (const auto& dir_entry : sf::directory_iterator{dbp}) {
@@ -176,34 +776,107 @@ struct BucketCache : public Notifiable
 
       /* repopulate cache basis */
       for (int ix = 0; ix < lmdb_count; ++ix) {
-	sf::path env_path{dbp / fmt::format("part_{}", ix)};
-	sf::create_directory(env_path);
-	auto env = getMDBEnv(env_path.string().c_str(), 0 /* flags? */, 0600);
-	envs.push_back(env);
+	open_env(ix);
       }
     }
 
-    inline std::shared_ptr<MDBEnv>& get_sp_env(Bucket* bucket)  {
-      return envs[(bucket->hk % lmdb_count)];
+    /* the env a new bucket's database goes in */
+    inline uint8_t index_of(Bucket* bucket) const {
+      return bucket->hk % lmdb_count;
+    }
+
+    inline std::shared_ptr<MDBEnv>& get_sp_env(uint8_t ix)  {
+      return envs[ix];
+    }
+
+    inline MDBEnv& get_env(uint8_t ix) {
+      return *(get_sp_env(ix));
+    }
+
+    inline Changelog* get_log(uint8_t ix) {
+      return logs[ix].get();
+    }
+
+    inline Reclaimer* get_reclaimer(uint8_t ix) {
+      return reclaimers[ix].get();
+    }
+
+    uint8_t count() const { return lmdb_count; }
+
+    /* at least count */
+    uint8_t opened() const { return n_envs; }
+
+    /* places new buckets among count envs, opening any not yet open;
+     * cached buckets keep their databases where they are until
+     * reclaimed, so no env is closed before the cache goes; not
+     * reentrant */
+    void set_count(uint8_t count) {
+      if (count < 1) {
+	return;
+      }
+      for (int ix = n_envs; ix < count; ++ix) {
+	open_env(ix);
+      }
+      lmdb_count = count;
     }
 
-    inline MDBEnv& get_env(Bucket* bucket) {
-      return *(get_sp_env(bucket));
+    Reclaimer& reclaimer(uint8_t ix) { return *reclaimers[ix]; }
+
+    EnvSpace space(uint8_t ix) {
+      auto& env = envs[ix];
+      EnvSpace sp;
+      MDB_envinfo info;
+      MDB_stat st;
+      mdb_env_info(*env, &info);
+      mdb_env_stat(*env, &st);
+      sp.page_size = st.ms_psize;
+      sp.map_pages = info.me_mapsize / st.ms_psize;
+      sp.used_pages = info.me_last_pgno + 1;
+      /* each freelist record is a list of page numbers, led by its
+       * length */
+      auto txn = env->getROTransaction();
+      MDBDbi free_dbi;
+      free_dbi.d_dbi = 0; /* FREE_DBI */
+      auto cursor = txn->getCursor(free_dbi);
+      MDBOutVal key, data;
+      int rc = cursor.get(key, data, MDB_FIRST);
+      while (rc == 0) {
+	sp.free_pages += data.get_struct<size_t>();
+	rc = cursor.next(key, data);
+      }
+      return sp;
+    } /* space */
+
+    /* stops the reclaimers; what they hadn't dropped goes with the envs,
+     * on restart */
+    void shutdown() {
+      for (int ix = 0; ix < n_envs; ++ix) {
+	reclaimers[ix].reset();
+      }
     }
 
     const std::string& get_root() const { return database_root; }
   } lmdbs;
 
+  /* last, so it is made after, and (see ~BucketCache) stopped before,
+   * the members its threads call into */
+  std::unique_ptr<Notify> un;
+
 public:
   BucketCache(std::string& bucket_root, std::string& database_root,
 	      uint32_t max_buckets=100, uint8_t max_lanes=3,
-	      uint8_t max_partitions=3, uint8_t lmdb_count=3)
+	      uint8_t max_partitions=3, uint8_t lmdb_count=3,
+	      const NotifyConfig& notify_config=NotifyConfig(),
+	      cohort::lru::Policy lru_policy=cohort::lru::Policy::LRU,
+	      const PinConfig& pin_config=PinConfig())
     : bucket_root(bucket_root), max_buckets(max_buckets),
+      recursive(notify_config.recursive),
+      metadata(notify_config.metadata),
+      lru(max_lanes, max_buckets/max_lanes, lru_policy),
+      cache(max_partitions, max_buckets/max_partitions),
+      rp(bucket_root),
       lmdbs(database_root, lmdb_count),
-      un(Notify::factory(this, bucket_root)),
-      lru(max_lanes, max_buckets/max_lanes),
-      cache(max_lanes, max_buckets/max_partitions),
-      rp(bucket_root)
+      un(Notify::factory(this, bucket_root, notify_config))
     {
       if (! (sf::exists(rp) && sf::is_directory(rp))) {
 	std::cerr << fmt::format("{} bucket root {} invalid", __func__,
@@ -211,19 +884,230 @@ public:
 	exit(1);
       }
 
+      /* generations are drawn from one cache-wide sequence, seeded from
+       * the clock, so a bucket's generation is never reused across
+       * recycle or restart and can serve as a listing ETag */
+      gen_seq = std::chrono::duration_cast<std::chrono::nanoseconds>(
+	std::chrono::system_clock::now().time_since_epoch()).count();
+
       sf::path dp{database_root};
       if (! (sf::exists(dp) && sf::is_directory(dp))) {
 	std::cerr << fmt::format("{} database root {} invalid", __func__,
 				 database_root) << std::endl;
 	exit(1);
       }
+
+      /* buckets coming and going */
+      un->watch_root(this);
+
+      lru.set_pin_budget(pin_config.budget);
+      for (const auto& name : pin_config.buckets) {
+	int rc = pin_bucket(name);
+	if (rc != 0) {
+	  std::cerr << fmt::format("{} pin bucket {} failed: {}", __func__,
+				   name, rc) << std::endl;
+	}
+      }
+    }
+
+  /* every background thread is stopped before any member goes: the
+   * evictor first, as it removes watches; then notify (reader shards,
+   * poller, hybrid rebalancer), whose events reach the cache, lru and
+   * lmdbs; then the fill scanners and the lmdb reclaimers */
+  ~BucketCache() {
+    if (evictor.joinable()) {
+      {
+	lock_guard guard{evictor_mtx};
+	evictor_stop = true;
+      }
+      evictor_cv.notify_one();
+      evictor.join();
+    }
+    un.reset();
+    scan_pool.shutdown();
+    lmdbs.shutdown();
+  }
+
+  /* keep at least lowat buckets' worth of headroom, reclaiming idle
+   * buckets up to hiwat in the background; starts the evictor on first
+   * use, 0 hiwat disables it */
+  void set_headroom(uint32_t lowat, uint32_t hiwat) {
+    headroom_lowat = lowat;
+    headroom_hiwat = std::max(lowat, hiwat);
+    if (headroom_hiwat > 0) {
+      start_evictor();
+    }
+    evictor_cv.notify_one();
+  }
+
+  /* lru weight dimensions, as set by weigh */
+  static constexpr int WEIGHT_ENTRIES = 0;
+  static constexpr int WEIGHT_BYTES = 1; /* lmdb pages, in bytes */
+
+  /* evict to keep the cached buckets' total entries and lmdb bytes within
+   * these (0 for no limit), as well as their number within max_buckets;
+   * may be changed at any time, the evictor trims the excess */
+  void set_budget(uint64_t max_entries, uint64_t max_bytes) {
+    lru.set_budget(WEIGHT_ENTRIES, max_entries);
+    lru.set_budget(WEIGHT_BYTES, max_bytes);
+    if (max_entries || max_bytes) {
+      start_evictor();
+    }
+    evictor_cv.notify_one();
+  }
+
+  /* have the evictor grow max_buckets, within as.min and as.max, where
+   * the miss curve shows more would save enough misses, or shrink it by
+   * a step where even the largest size tracked wouldn't, each interval */
+  void set_autosize(const AutoSize& as) {
+    {
+      lock_guard guard{evictor_mtx};
+      autosize = as;
+    }
+    if (as.max > 0) {
+      lru.track_misses(as.max);
+      start_evictor();
+    }
+  }
+
+  /* (evictor_mtx) */
+  void autosize_step() {
+    if (lru.curve_samples() < autosize.samples) {
+      return;
+    }
+    auto curve = lru.miss_curve();
+    uint32_t cap = curve[0].size;
+    uint32_t step = std::max(curve[1].size - cap, 1U);
+    /* the best saving per step, to any size tracked */
+    double gain{0};
+    for (size_t ix = 1; ix < curve.size(); ++ix) {
+      gain = std::max(gain, (curve[0].miss_ratio - curve[ix].miss_ratio) / ix);
+    }
+    uint32_t size{cap};
+    if ((gain >= autosize.grow_gain) && (cap < autosize.max)) {
+      size = std::min(cap + step, autosize.max);
+    } else if (((curve[0].miss_ratio - curve.back().miss_ratio) <
+		autosize.shrink_gain) && (cap > autosize.min)) {
+      size = std::max(cap - std::min(step, cap), autosize.min);
+    }
+    if (size != cap) {
+      lru.set_capacity(size);
+      max_buckets = lru.capacity();
+      ++resize_count;
+    } else {
+      lru.reset_curve();
+    }
+  } /* autosize_step */
+
+  /* the layout fixed at construction, changed by reshape */
+  struct Shape
+  {
+    uint32_t max_buckets{0};
+    uint8_t lanes{0};
+    uint8_t partitions{0};
+    uint8_t lmdb_count{0};
+  };
+
+  Shape get_shape() {
+    return Shape{max_buckets, uint8_t(lru.get_lanes()),
+		 uint8_t(cache.n_part), lmdbs.count()};
+  }
+
+  /* changes the layout under load, leaving 0 members as they are: lru
+   * objects are re-laned and partitions rehashed a batch at a time (see
+   * LRU::set_lanes, TreeX::rehash), so that callers wait only briefly;
+   * a smaller max_buckets is reached by the evictor, and only new
+   * buckets are placed by a new lmdb_count */
+  void reshape(const Shape& sh) {
+    lock_guard guard{reshape_mtx};
+    if (sh.max_buckets) {
+      max_buckets = sh.max_buckets;
+    }
+    if (sh.lanes) {
+      lru.set_lanes(sh.lanes);
+    }
+    if (sh.max_buckets) {
+      lru.set_capacity(max_buckets);
+    }
+    if (sh.partitions) {
+      cache.rehash(sh.partitions, max_buckets / sh.partitions,
+		   [](const Bucket& b) { return b.hk; });
+    }
+    if (sh.lmdb_count) {
+      lmdbs.set_count(sh.lmdb_count);
+    }
+    if (lru.over_capacity()) {
+      start_evictor();
+      evictor_cv.notify_one();
+    }
+  } /* reshape */
+
+  void start_evictor() {
+    lock_guard guard{evictor_mtx};
+    if (! evictor.joinable()) {
+      evictor = std::thread(&BucketCache::evict_loop, this);
+    }
+  }
+
+  /* b's lru weight, from its database as of txn (before commit) */
+  void weigh(MDBRWTransaction& txn, Bucket* b) {
+    MDB_stat st;
+    if (mdb_stat(*txn, b->dbi, &st) != 0) {
+      return;
+    }
+    lru.set_weight(b, WEIGHT_ENTRIES, st.ms_entries);
+    lru.set_weight(b, WEIGHT_BYTES, uint64_t(st.ms_psize) *
+		   (st.ms_branch_pages + st.ms_leaf_pages + st.ms_overflow_pages));
+    if (lru.over_budget()) {
+      /* not here--we hold b and a write txn */
+      evictor_cv.notify_one();
+    }
+  } /* weigh */
+
+  void evict_loop() {
+    unique_lock lk{evictor_mtx};
+    auto last_size = std::chrono::steady_clock::now();
+    while (! evictor_stop) {
+      auto now = std::chrono::steady_clock::now();
+      if ((autosize.max > 0) && ((now - last_size) >= autosize.interval)) {
+	autosize_step();
+	last_size = now;
+      }
+      if (idle_expiry) {
+	lk.unlock();
+	sweep_idle();
+	lk.lock();
+      }
+      if ((lru.headroom() < headroom_lowat) || lru.over_budget() ||
+	  lru.over_capacity()) {
+	lk.unlock();
+	uint32_t n = lru.evict_free(headroom_hiwat);
+	prereclaim_count += n;
+	lk.lock();
+	if (n > 0) {
+	  continue;
+	}
+      }
+      /* also retries, if everything was in use */
+      evictor_cv.wait_for(lk, evictor_interval);
     }
+  } /* evict_loop */
 
   static constexpr uint32_t FLAG_NONE     = 0x0000;
   static constexpr uint32_t FLAG_CREATE   = 0x0001;
   static constexpr uint32_t FLAG_LOCK     = 0x0002;
+  static constexpr uint32_t FLAG_UNCHANGED = 0x0004;
+  static constexpr uint32_t FLAG_RELIST   = 0x0008;
+  static constexpr uint32_t FLAG_NOENT    = 0x0010;
+  static constexpr uint32_t FLAG_FULL     = 0x0020; /* see lru Overflow */
 
   typedef std::tuple<Bucket*, uint32_t> GetBucketResult;
+  typedef std::tuple<uint32_t, uint64_t> ListBucketResult; /* flags, gen */
+  typedef std::tuple<uint32_t, uint64_t> ChangesResult; /* flags, seq */
+
+  inline uint64_t next_gen() {
+    return ++gen_seq;
+  }
 
   GetBucketResult get_bucket(const std::string& name, uint32_t flags)
     {
@@ -232,13 +1116,18 @@ public:
       Bucket* b{nullptr};
       Bucket::Factory fac(this, name);
       Bucket::bucket_avl_cache::Latch lat;
-      uint32_t iflags{cohort::lru::FLAG_INITIAL};
+      /* an insert that would wait for an idle bucket (lru Overflow::WAIT)
+       * waits unlatched--reclaim needs the latch of the bucket it takes,
+       * which may be ours--and then looks up again */
+      uint32_t iflags{cohort::lru::FLAG_INITIAL|cohort::lru::FLAG_NOWAIT};
+      std::chrono::steady_clock::time_point deadline{};
       GetBucketResult result{nullptr, 0};
 
     retry:
       b = cache.find_latch(fac.hk /* partition selector */,
 			   name /* key */, lat /* serializer */, Bucket::bucket_avl_cache::FLAG_LOCK);
       /* LATCHED */
+      fac.latched = lat.p;
       if (b) {
 	b->mtx.lock();
 	if (b->deleted() ||
@@ -258,27 +1147,49 @@ public:
 	  b->mtx.lock();
 
 	  /* attach bucket to an lmdb partition and prepare it for i/o */
-	  auto& env = lmdbs.get_sp_env(b);
+	  uint8_t env_ix = lmdbs.index_of(b);
+	  auto& env = lmdbs.get_sp_env(env_ix);
 	  auto dbi = env->openDB(b->name, MDB_CREATE);
-	  b->set_env(env, dbi);
+	  /* a database left behind by an earlier bucket of this name is
+	   * emptied by fill, not by its reclaimer */
+	  lmdbs.get_reclaimer(env_ix)->cancel(dbi);
+	  b->set_env(env, dbi, lmdbs.get_log(env_ix),
+		     lmdbs.get_reclaimer(env_ix));
+	  b->handle = handles.acquire(b);
 
 	  if (! (iflags & cohort::lru::FLAG_RECYCLE)) [[likely]] {
 	    /* inserts at cached insert iterator, releasing latch */
 	    cache.insert_latched(b, lat, Bucket::bucket_avl_cache::FLAG_UNLOCK);
 	  } else {
-	    /* recycle step invalidates Latch */
-	    lat.lock->unlock(); /* !LATCHED */
+	    /* recycle step invalidates Latch's insert position, but not
+	     * its lock, which keeps out a rehash and a racing create */
 	    cache.insert(fac.hk, b, Bucket::bucket_avl_cache::FLAG_NONE);
+	    lat.lock->unlock(); /* !LATCHED */
 	  }
 	  get<1>(result) |= BucketCache::FLAG_CREATE;
+	  if (lru.headroom() < headroom_lowat) {
+	    evictor_cv.notify_one();
+	  }
 	} else {
-	  /* XXX lru allocate failed? seems impossible--that would mean that
-	   * fallback to the allocator also failed, and maybe we should abend */
-	  lat.lock->unlock();
-	  goto retry; /* !LATCHED */
+	  lat.lock->unlock(); /* !LATCHED */
+	  if (iflags & cohort::lru::FLAG_BLOCKED) {
+	    iflags &= ~cohort::lru::FLAG_BLOCKED;
+	    if (deadline == std::chrono::steady_clock::time_point{}) {
+	      deadline = lru.wait_deadline();
+	    }
+	    if (lru.wait_idle(deadline)) {
+	      goto retry;
+	    }
+	  }
+	  /* full, and nothing reclaimable (lru Overflow::FAIL or WAIT) */
+	  return GetBucketResult{nullptr, BucketCache::FLAG_FULL};
 	}
       } /* have Bucket */
 
+      if (idle_expiry) [[unlikely]] {
+	idle_touch(b, get<1>(result) & BucketCache::FLAG_CREATE);
+      }
+
       if (! (flags & BucketCache::FLAG_LOCK)) {
 	b->mtx.unlock();
       }
@@ -286,113 +1197,903 @@ public:
       return result;
     } /* get_bucket */
 
-  void fill(Bucket* bucket, uint32_t flags) /* assert: LOCKED */
+  /* a cached bucket, referenced and LOCKED, or nullptr--unlike get_bucket,
+   * never creates one */
+  Bucket* find_bucket(const std::string& name)
+    {
+      uint64_t hk = XXH64(name.c_str(), name.length(), Bucket::seed);
+      Bucket::bucket_avl_cache::Latch lat;
+      Bucket* b = cache.find_latch(hk, name, lat,
+				   Bucket::bucket_avl_cache::FLAG_LOCK);
+      /* LATCHED */
+      if (b) {
+	b->mtx.lock();
+	if (b->deleted() ||
+	    ! lru.ref(b, cohort::lru::FLAG_NONE)) {
+	  /* being reclaimed */
+	  b->mtx.unlock();
+	  b = nullptr;
+	}
+      }
+      lat.lock->unlock();
+      return b;
+    } /* find_bucket */
+
+  /* returns 0, or -ENOENT if the bucket directory is gone (or went away
+   * while being read), in which case nothing is loaded */
+  int fill(Bucket* bucket, uint32_t flags) /* assert: LOCKED */
     {
+      auto start = std::chrono::steady_clock::now();
       sf::path bp{rp / bucket->name};
-      if (! (sf::exists(rp) && sf::is_directory(rp))) {
-	std::cerr << fmt::format("{} bucket {} invalid", __func__, bucket->name)
-		  << std::endl;
-	exit(1);
+      std::vector<TreeWalk::Entry> keys;
+      TreeWalk::Config wcfg{fill_threads, fill_inflight, metadata};
+      if (TreeWalk::walk(scan_pool, bp, recursive, wcfg, keys) != 0) {
+	return -ENOENT;
+      }
+      if (metadata && (bucket->dfd == -1)) {
+	bucket->dfd = open(bp.c_str(), O_PATH|O_DIRECTORY|O_CLOEXEC);
       }
       auto txn = bucket->env->getRWTransaction();
-      for (const auto& dir_entry : sf::directory_iterator{bp}) {
-	auto fname = dir_entry.path().filename().string();
-	txn->put(bucket->dbi, fname, fname /* TODO: structure, stat, &c */);
-	//std::cout << fmt::format("{} {}", __func__, fname) << '\n';
+      /* the keys are sorted, so they are appended to the b-tree rather than
+       * searched for; leftovers of an earlier life of this name would
+       * defeat that */
+      mdb_drop(*txn, bucket->dbi, 0);
+      for (const auto& e : keys) {
+	if (metadata) {
+	  ObjectMeta meta{e.size, e.mtime};
+	  txn->put(bucket->dbi, e.key, meta.value(), MDB_APPEND);
+	} else {
+	  txn->put(bucket->dbi, e.key, e.key, MDB_APPEND);
+	}
       }
+      weigh(txn, bucket);
+      uint64_t base = bucket->clog->mark();
       txn->commit();
+      bucket->clog->publish(base);
+      /* what evicting it would cost (lru Policy::COST): the time to list
+       * it again, in us, and as much again per entry loaded */
+      uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(
+	std::chrono::steady_clock::now() - start).count();
+      lru.set_cost(bucket, us + keys.size());
+      ++fill_count;
+      fill_us += us;
+      bucket->gen = bucket->fill_gen = next_gen();
+      bucket->log_base = base;
+      bucket->suppress.clear();
       bucket->flags |= Bucket::FLAG_FILLED;
-      un->add_watch(bucket->name, bucket);
+      un->add_watch(bucket->name, bucket->handle);
+      return 0;
     } /* fill */
 
-  void list_bucket(std::string& name, std::string& marker,
-		   const fu2::unique_function<int(const std::string_view&) const>& func /* XXX for now */)
+  /* metadata mode: the value for oname, from one fstatat on the bucket
+   * directory; false if it's gone */
+  bool stat_meta(Bucket* b, const std::string_view& oname, ObjectMeta& meta)
+    {
+      struct stat st;
+      std::string path{oname};
+      if ((b->dfd == -1) ||
+	  (fstatat(b->dfd, path.c_str(), &st, AT_SYMLINK_NOFOLLOW) != 0)) {
+	return false;
+      }
+      meta = ObjectMeta::of(st);
+      return true;
+    } /* stat_meta */
+
+  /* the value to store for a new or changed object */
+  void put_object_value(MDBRWTransaction& txn, Bucket* b,
+			const std::string_view& oname)
+    {
+      if (metadata) {
+	ObjectMeta meta;
+	(void) stat_meta(b, oname, meta); /* not there yet, zeroes */
+	txn->put(b->dbi, oname, meta.value());
+      } else {
+	txn->put(b->dbi, oname, oname);
+      }
+    } /* put_object_value */
+
+  /* drop a cached bucket whose directory was removed or renamed away: it
+   * leaves the tree at once, so the next lookup starts afresh, its watch
+   * and lmdb data are released, and the object goes to the lru free pool
+   * (or, while still in use, to the cold end of its lane, to be recycled
+   * first); returns false if it wasn't cached */
+  bool evict_bucket(const std::string& name)
+    {
+      if (! evict_bucket_if(name, [](Bucket* b) { return true; })) {
+	return false;
+      }
+      evict_count++;
+      return true;
+    } /* evict_bucket */
+
+  /* as evict_bucket, if pred(b) holds (LATCHED) */
+  template <typename P>
+  bool evict_bucket_if(const std::string& name, P pred)
+    {
+      Bucket::Factory fac(this, name);
+      Bucket::bucket_avl_cache::Latch lat;
+      Bucket* b = cache.find_latch(fac.hk, name, lat,
+				   Bucket::bucket_avl_cache::FLAG_LOCK);
+      /* LATCHED */
+      if ((! b) || (! pred(b))) {
+	lat.lock->unlock();
+	return false;
+      }
+      /* stale events rejected from here on */
+      b->release_handle();
+      {
+	lock_guard guard{b->mtx};
+	if (b->deleted()) {
+	  /* being reclaimed */
+	  lat.lock->unlock();
+	  return false;
+	}
+	b->flags |= Bucket::FLAG_DELETED;
+	b->flags &= ~Bucket::FLAG_FILLED;
+	(void) lru.ref(b, cohort::lru::FLAG_NONE);
+	/* a pin can't outlive the bucket */
+	lru.unpin(b);
+	cache.remove(fac.hk, b, Bucket::bucket_avl_cache::FLAG_NONE);
+	/* its data is on the way out */
+	lru.set_weight(b, WEIGHT_ENTRIES, 0);
+	lru.set_weight(b, WEIGHT_BYTES, 0);
+      }
+      /* still LATCHED, so a new bucket of this name can't yet have
+       * watched or reopened (cancel) the dbi */
+      un->remove_watch(name);
+      b->reclaimer->enqueue(b->dbi);
+      lat.lock->unlock();
+      /* !LATCHED, as reclaim latches */
+      (void) lru.retire(b);
+      return true;
+    } /* evict_bucket_if */
+
+  /* keeps the bucket out of eviction until unpin_bucket, filling it
+   * now if need be; returns 0, -ENOENT if there is no such bucket,
+   * -ENOSPC if the pin budget is spent, or -EBUSY if the cache is full */
+  int pin_bucket(const std::string& name)
+    {
+      auto [b, flags] = get_bucket(name, BucketCache::FLAG_LOCK);
+      if (! b) [[unlikely]] {
+	return -EBUSY;
+      }
+      unique_lock ulk{b->mtx, std::adopt_lock};
+      if (! (b->flags & Bucket::FLAG_FILLED)) {
+	if (fill(b, FLAG_NONE) != 0) {
+	  ulk.unlock();
+	  lru.unref(b, cohort::lru::FLAG_NONE);
+	  evict_bucket(name);
+	  return -ENOENT;
+	}
+      }
+      int rc = lru.pin(b) ? 0 : -ENOSPC;
+      ulk.unlock();
+      lru.unref(b, cohort::lru::FLAG_NONE);
+      return rc;
+    } /* pin_bucket */
+
+  /* returns 0, or -ENOENT if the bucket isn't cached */
+  int unpin_bucket(const std::string& name)
+    {
+      Bucket::Factory fac(this, name);
+      Bucket::bucket_avl_cache::Latch lat;
+      Bucket* b = cache.find_latch(fac.hk, name, lat,
+				   Bucket::bucket_avl_cache::FLAG_LOCK);
+      /* LATCHED */
+      if (! b) {
+	lat.lock->unlock();
+	return -ENOENT;
+      }
+      (void) lru.ref(b, cohort::lru::FLAG_NONE);
+      lat.lock->unlock();
+      /* !LATCHED */
+      lru.unpin(b);
+      lru.unref(b, cohort::lru::FLAG_NONE);
+      return 0;
+    } /* unpin_bucket */
+
+  /* the most buckets pinned at once; lowering it unpins nothing */
+  void set_pin_budget(uint32_t budget) {
+    lru.set_pin_budget(budget);
+  }
+
+  /* reclaims buckets not gotten for ttl, 0 for never, as evict_bucket
+   * does, so that they give up their watch, notify traffic and lmdb
+   * pages at once, and their Bucket to the lru free pool (LRU::retire);
+   * pinned buckets are exempt; the evictor sweeps them
+   * within a slot (ttl / wheel_slots) or its interval of expiring */
+  void set_idle_ttl(std::chrono::milliseconds ttl) {
+    auto now = std::chrono::steady_clock::now();
+    {
+      lock_guard guard{wheel_mtx};
+      idle_ttl = ttl;
+      idle_expiry = (ttl.count() > 0);
+      ++wheel_epoch;
+      wheel.clear();
+      wheeled.clear();
+      if (! idle_expiry) {
+	return;
+      }
+      wheel_tick = std::max(ttl / wheel_slots, std::chrono::milliseconds(1));
+      wheel.resize(wheel_slots);
+      wheel_time = std::chrono::steady_clock::time_point{
+	(now.time_since_epoch() / wheel_tick) * wheel_tick};
+    }
+    /* buckets already cached are idle from now */
+    cache.for_each([this, now](Bucket* b) {
+      b->atime = now.time_since_epoch().count();
+      lock_guard guard{wheel_mtx};
+      if (idle_expiry && wheeled.insert(b->name).second) {
+	wheel_file(b->name, now + idle_ttl);
+      }
+    }, Bucket::bucket_avl_cache::FLAG_LOCK);
+    start_evictor();
+  } /* set_idle_ttl */
+
+  /* (wheel_mtx) */
+  void wheel_file(const std::string& name,
+		  std::chrono::steady_clock::time_point deadline) {
+    /* overdue goes in the next slot due */
+    deadline = std::max(deadline, wheel_time);
+    wheel[(deadline.time_since_epoch() / wheel_tick) % wheel_slots]
+      .push_back(name);
+  }
+
+  /* b was gotten (from get_bucket) */
+  void idle_touch(Bucket* b, bool created) {
+    auto now = std::chrono::steady_clock::now();
+    b->atime = now.time_since_epoch().count();
+    if (created) {
+      lock_guard guard{wheel_mtx};
+      if (idle_expiry && wheeled.insert(b->name).second) {
+	wheel_file(b->name, now + idle_ttl);
+      }
+    }
+  } /* idle_touch */
+
+  /* evicts the buckets in the slots come due that have been idle for
+   * idle_ttl, and files the rest again by their last use (evictor) */
+  void sweep_idle() {
+    auto now = std::chrono::steady_clock::now();
+    std::vector<std::string> due;
+    std::chrono::milliseconds ttl;
+    uint64_t epoch;
+    {
+      lock_guard guard{wheel_mtx};
+      if (! idle_expiry) {
+	return;
+      }
+      ttl = idle_ttl;
+      epoch = wheel_epoch;
+      while ((wheel_time + wheel_tick) <= now) {
+	auto& slot =
+	  wheel[(wheel_time.time_since_epoch() / wheel_tick) % wheel_slots];
+	std::move(slot.begin(), slot.end(), std::back_inserter(due));
+	slot.clear();
+	wheel_time += wheel_tick;
+      }
+    }
+    if (due.empty()) {
+      return;
+    }
+    auto cutoff = (now - ttl).time_since_epoch().count();
+    /* still cached, and when each is due again */
+    std::vector<std::pair<std::string, std::chrono::steady_clock::time_point>>
+      live;
+    for (auto& name : due) {
+      std::chrono::steady_clock::time_point next;
+      bool found{false};
+      bool expired = evict_bucket_if(name, [&](Bucket* b) {
+	found = true;
+	if (lru.pinned(b)) {
+	  next = now + ttl;
+	  return false;
+	}
+	next = std::chrono::steady_clock::time_point{
+	  std::chrono::steady_clock::duration{b->atime}} + ttl;
+	return b->atime <= cutoff;
+      });
+      if (expired) {
+	++expire_count;
+      }
+      if (found && (! expired)) {
+	live.emplace_back(std::move(name), next);
+      } else {
+	forget_idle(name, now + ttl, epoch);
+      }
+    }
+    lock_guard guard{wheel_mtx};
+    if (wheel_epoch != epoch) {
+      /* set_idle_ttl started over */
+      return;
+    }
+    for (auto& [name, next] : live) {
+      wheel_file(name, next);
+    }
+  } /* sweep_idle */
+
+  /* name is no longer cached: unfiled, unless created again meanwhile
+   * without being filed (idle_touch saw it still filed), in which case
+   * it is due again at next */
+  void forget_idle(const std::string& name,
+		   std::chrono::steady_clock::time_point next, uint64_t epoch) {
+    Bucket::Factory fac(this, name);
+    Bucket::bucket_avl_cache::Latch lat;
+    Bucket* b = cache.find_latch(fac.hk, name, lat,
+				 Bucket::bucket_avl_cache::FLAG_LOCK);
+    /* LATCHED */
+    {
+      lock_guard guard{wheel_mtx};
+      if (wheel_epoch == epoch) {
+	if (b) {
+	  wheel_file(name, next);
+	} else {
+	  wheeled.erase(name);
+	}
+      }
+    }
+    lat.lock->unlock();
+  } /* forget_idle */
+
+  /* calls f for each key from marker on */
+  template <typename F>
+  void scan_bucket(Bucket* b, const std::string& marker, F&& f)
+    {
+      auto txn = b->env->getROTransaction();
+      auto cursor=txn->getCursor(b->dbi);
+      MDBOutVal key, data;
+      int rc;
+
+      if (! marker.empty()) {
+	MDBInVal k(marker);
+	rc = cursor.lower_bound(k, key, data);
+      } else {
+	/* position at start of index */
+	rc = cursor.get(key, data, MDB_FIRST);
+      }
+      while (rc == 0) {
+	f(key.get<string_view>());
+	rc = cursor.get(key, data, MDB_NEXT);
+      }
+    } /* scan_bucket */
+
+  std::shared_ptr<const ListPage> page_bucket(Bucket* b, const std::string& marker,
+					      uint64_t gen)
+    {
+      auto page = std::make_shared<ListPage>();
+      page->gen = gen;
+      scan_bucket(b, marker, [&page](const std::string_view& k) {
+	page->push_back(k);
+      });
+      return page;
+    } /* page_bucket */
+
+  /* returns the generation of a cached, filled bucket, or 0 */
+  uint64_t get_generation(const std::string& name)
+    {
+      uint64_t gen{0};
+      uint64_t hk = XXH64(name.c_str(), name.length(), Bucket::seed);
+      Bucket::bucket_avl_cache::Latch lat;
+      Bucket* b = cache.find_latch(hk, name, lat,
+				   Bucket::bucket_avl_cache::FLAG_LOCK);
+      /* LATCHED */
+      if (b && (b->flags & Bucket::FLAG_FILLED)) {
+	gen = b->gen;
+      }
+      lat.lock->unlock();
+      return gen;
+    } /* get_generation */
+
+  /* if if_generation_differs is nonzero and equals the bucket's current
+   * generation, returns FLAG_UNCHANGED without listing; the generation
+   * returned may be used as an ETag for the listing */
+  ListBucketResult list_bucket(std::string& name, std::string& marker,
+			       const fu2::unique_function<int(const std::string_view&) const>& func /* XXX for now */,
+			       uint64_t if_generation_differs = 0)
     {
+      ListBucketResult result{FLAG_NONE, 0};
       GetBucketResult gbr = get_bucket(name, BucketCache::FLAG_LOCK);
       auto [b, flags] = gbr;
+      if (! b) [[unlikely]] {
+	return ListBucketResult{flags, 0};
+      }
 
-      if (b /* XXX again, can this fail? */) {
+      if (b) {
+	unique_lock ulk{b->mtx, std::adopt_lock};
 	if (! (b->flags & Bucket::FLAG_FILLED)) {
 	  /* bulk load into lmdb cache */
-	  fill(b, FLAG_NONE);
+	  if (fill(b, FLAG_NONE) != 0) {
+	    ulk.unlock();
+	    lru.unref(b, cohort::lru::FLAG_NONE);
+	    evict_bucket(name);
+	    return ListBucketResult{FLAG_NOENT, 0};
+	  }
 	}
-	/* display them */
-	b->mtx.unlock();
+
+	if (if_generation_differs &&
+	    (b->gen == if_generation_differs)) {
+	  ulk.unlock();
+	  lru.unref(b, cohort::lru::FLAG_NONE);
+	  return ListBucketResult{FLAG_UNCHANGED, if_generation_differs};
+	}
+
+	un->touch(b->name);
+
+	/* single-flight, once contended: the first listing of a marker at a
+	 * generation streams; one that arrives while it runs scans into a
+	 * page, and identical listings after that wait for the page */
+	uint64_t gen = b->gen;
+	std::shared_ptr<ListFlight> flight;
+	const auto& elt = b->flights.find(marker);
+	if ((elt != b->flights.end()) && (elt->second->gen == gen) &&
+	    (! elt->second->done)) {
+	  flight = elt->second;
+	}
+	if (flight && flight->paging) {
+	  b->cv.wait(ulk, [&flight]{ return flight->done; });
+	  auto page = flight->page;
+	  ulk.unlock();
+	  /*! LOCKED */
+	  if (page) [[likely]] {
+	    coalesce_count++;
+	  } else {
+	    /* the leader failed, scan for ourselves */
+	    page = page_bucket(b, marker, gen);
+	  }
+	  for (size_t ix = 0; ix < page->size(); ++ix) {
+	    (void) func((*page)[ix]);
+	  }
+	} else if (flight) {
+	  /* lead the page */
+	  flight->paging = true;
+	  ++(flight->listers);
+	  ulk.unlock();
+	  /*! LOCKED */
+	  std::shared_ptr<const ListPage> page;
+	  const auto publish = [&]() {
+	    ulk.lock();
+	    flight->page = page;
+	    flight->done = true;
+	    --(flight->listers);
+	    const auto& cur = b->flights.find(marker);
+	    if ((cur != b->flights.end()) && (cur->second == flight)) {
+	      b->flights.erase(cur);
+	    }
+	    ulk.unlock();
+	    b->cv.notify_all();
+	  };
+	  try {
+	    page = page_bucket(b, marker, gen);
+	  } catch (...) {
+	    publish();
+	    throw;
+	  }
+	  publish();
+	  for (size_t ix = 0; ix < page->size(); ++ix) {
+	    (void) func((*page)[ix]);
+	  }
+	} else {
+	  /* stream, as the only listing of marker at gen */
+	  flight = std::make_shared<ListFlight>(gen);
+	  b->flights.insert_or_assign(marker, flight);
+	  ulk.unlock();
+	  /*! LOCKED */
+	  const auto leave = [&]() {
+	    ulk.lock();
+	    const auto& cur = b->flights.find(marker);
+	    if ((--(flight->listers) == 0) &&
+		(cur != b->flights.end()) && (cur->second == flight)) {
+	      b->flights.erase(cur);
+	    }
+	    ulk.unlock();
+	  };
+	  try {
+	    scan_bucket(b, marker, [&func](const std::string_view& k) {
+	      (void) func(k);
+	    });
+	  } catch (...) {
+	    leave();
+	    throw;
+	  }
+	  leave();
+	}
+	get<1>(result) = gen;
+	lru.unref(b, cohort::lru::FLAG_NONE);
+      }
+      return result;
+    } /* list_bucket */
+
+  /* the least key greater than every key starting with s, or "" if there
+   * is none */
+  static std::string prefix_successor(std::string s) {
+    while ((! s.empty()) && (uint8_t(s.back()) == 0xff)) {
+      s.pop_back();
+    }
+    if (! s.empty()) {
+      s.back() = char(uint8_t(s.back()) + 1);
+    }
+    return s;
+  }
+
+  /* list the keys under prefix from marker, rolling up those containing
+   * delimiter after the prefix into one common prefix each (func's second
+   * argument is true for those), as an S3 delimited listing; most useful
+   * in recursive mode, where keys are paths */
+  ListBucketResult list_bucket_delimited(std::string& name, const std::string& prefix,
+					 const std::string& delimiter, const std::string& marker,
+					 const fu2::unique_function<int(const std::string_view&, bool) const>& func)
+    {
+      ListBucketResult result{FLAG_NONE, 0};
+      GetBucketResult gbr = get_bucket(name, BucketCache::FLAG_LOCK);
+      auto [b, flags] = gbr;
+      if (! b) [[unlikely]] {
+	return ListBucketResult{flags, 0};
+      }
+
+      if (b) {
+	unique_lock ulk{b->mtx, std::adopt_lock};
+	if (! (b->flags & Bucket::FLAG_FILLED)) {
+	  if (fill(b, FLAG_NONE) != 0) {
+	    ulk.unlock();
+	    lru.unref(b, cohort::lru::FLAG_NONE);
+	    evict_bucket(name);
+	    return ListBucketResult{FLAG_NOENT, 0};
+	  }
+	}
+	un->touch(b->name);
+	get<1>(result) = b->gen;
+	ulk.unlock();
 	/*! LOCKED */
 
 	auto txn = b->env->getROTransaction();
 	auto cursor=txn->getCursor(b->dbi);
 	MDBOutVal key, data;
-	uint64_t count{0};
-
-	const auto proc_result = [&]() {
-	  std::string_view svk = key.get<string_view>();
-	  (void) func(svk);
-	  count++;
-	};
-
-	if (! marker.empty()) {
-	  MDBInVal k(marker);
-	  auto rc = cursor.lower_bound(k, key, data);
-	  if (rc == MDB_NOTFOUND) {
-	    /* no key sorts after k/marker, so there is nothing to do */
-	    return;
+	MDBInVal k(std::max(marker, prefix));
+	int rc = cursor.lower_bound(k, key, data);
+	while (rc == 0) {
+	  auto kv = key.get<string_view>();
+	  if (! kv.starts_with(prefix)) {
+	    break;
 	  }
-	  proc_result();	  
-	} else {
-	  /* position at start of index */
-	  cursor.get(key, data, MDB_FIRST);
-	  proc_result();
+	  auto pos = delimiter.empty() ? std::string_view::npos :
+	    kv.find(delimiter, prefix.size());
+	  if (pos == std::string_view::npos) {
+	    (void) func(kv, false);
+	    rc = cursor.get(key, data, MDB_NEXT);
+	    continue;
+	  }
+	  /* one entry for the common prefix, then seek past it */
+	  std::string cp{kv.substr(0, pos + delimiter.size())};
+	  (void) func(cp, true);
+	  auto next = prefix_successor(cp);
+	  if (next.empty()) {
+	    break;
+	  }
+	  MDBInVal nk(next);
+	  rc = cursor.lower_bound(nk, key, data);
+	}
+	lru.unref(b, cohort::lru::FLAG_NONE);
+      }
+      return result;
+    } /* list_bucket_delimited */
+
+  /* write-through: apply the application's own changes to a cached bucket
+   * synchronously, and ignore their inotify echo when it arrives; returns
+   * 0 if applied, or -ENOENT if the bucket is not cached, or not yet
+   * filled, and will see the changes when it is */
+  int write_through(const std::string& bname, Notifiable::EventType type,
+		    const std::vector<std::string>& onames)
+    {
+      Bucket* b = find_bucket(bname);
+      if (! b) {
+	return -ENOENT;
+      }
+
+      {
+	unique_lock ulk{b->mtx, std::adopt_lock};
+	if (! (b->flags & Bucket::FLAG_FILLED)) {
+	  ulk.unlock();
+	  lru.unref(b, cohort::lru::FLAG_NONE);
+	  return -ENOENT;
+	}
+	ulk.unlock();
+	/*! LOCKED */
+
+	auto txn = b->env->getRWTransaction();
+	for (const auto& oname : onames) {
+	  if (type == Notifiable::EventType::ADD) {
+	    put_object_value(txn, b, oname);
+	  } else {
+	    txn->del(b->dbi, oname);
+	  }
+	  b->clog->append(txn, b->name, type, oname);
 	}
-	while(! cursor.get(key, data, MDB_NEXT)) {
-	  proc_result();
+	b->clog->trim(txn, changelog_max);
+	uint64_t seq = b->clog->next;
+	weigh(txn, b);
+	txn->commit();
+	b->clog->publish(seq);
+	uint64_t gen = next_gen();
+	b->gen = gen;
+
+	/* only a committed change may suppress its echo */
+	auto now = std::chrono::steady_clock::now();
+	ulk.lock();
+	if (b->flags & Bucket::FLAG_FILLED) {
+	  for (const auto& oname : onames) {
+	    b->suppress_echo(type, oname, gen, now);
+	  }
 	}
+	ulk.unlock();
 	lru.unref(b, cohort::lru::FLAG_NONE);
       }
-    } /* list_bucket */
+      return 0;
+    } /* write_through */
+
+  int put_object(const std::string& bname, const std::string& oname)
+    {
+      return write_through(bname, Notifiable::EventType::ADD, {oname});
+    }
+
+  int delete_object(const std::string& bname, const std::string& oname)
+    {
+      return write_through(bname, Notifiable::EventType::REMOVE, {oname});
+    }
+
+  int put_objects(const std::string& bname,
+		  const std::vector<std::string>& onames)
+    {
+      return write_through(bname, Notifiable::EventType::ADD, onames);
+    }
+
+  int delete_objects(const std::string& bname,
+		     const std::vector<std::string>& onames)
+    {
+      return write_through(bname, Notifiable::EventType::REMOVE, onames);
+    }
+
+  /* read-your-writes barrier: returns 0 once every change to the named
+   * bucket's directory made before the call is reflected in its listing,
+   * or -ETIMEDOUT at deadline */
+  int fence(const std::string& name,
+	    std::chrono::steady_clock::time_point deadline)
+    {
+      return un->fence(name, deadline);
+    } /* fence */
+
+  /* metadata mode: the cached size and mtime of an object; returns 0,
+   * -ENOENT, -EINVAL if values aren't metadata, or -EBUSY if the cache
+   * is full (FLAG_FULL) */
+  int stat_object(std::string& name, const std::string& oname, ObjectMeta& meta)
+    {
+      if (! metadata) {
+	return -EINVAL;
+      }
+      int r{-ENOENT};
+      GetBucketResult gbr = get_bucket(name, BucketCache::FLAG_LOCK);
+      auto [b, flags] = gbr;
+      if (! b) [[unlikely]] {
+	return -EBUSY; /* FLAG_FULL */
+      }
+
+      if (b) {
+	unique_lock ulk{b->mtx, std::adopt_lock};
+	if (! (b->flags & Bucket::FLAG_FILLED)) {
+	  if (fill(b, FLAG_NONE) != 0) {
+	    ulk.unlock();
+	    lru.unref(b, cohort::lru::FLAG_NONE);
+	    evict_bucket(name);
+	    return -ENOENT;
+	  }
+	}
+	ulk.unlock();
+	/*! LOCKED */
+	auto txn = b->env->getROTransaction();
+	MDBOutVal data;
+	if ((txn->get(b->dbi, oname, data) == 0) &&
+	    ObjectMeta::decode(data.get<string_view>(), meta)) {
+	  r = 0;
+	}
+	lru.unref(b, cohort::lru::FLAG_NONE);
+      }
+      return r;
+    } /* stat_object */
+
+  /* calls func for each change to the named bucket logged after seq, and
+   * returns the sequence to resume from; FLAG_RELIST is returned when the
+   * changes since seq are no longer all logged (the log wrapped, or the
+   * bucket was refilled) or seq was not issued by this bucket's current
+   * fill (0 never is), and the caller must list the bucket in full
+   * before resuming from the returned sequence; a bucket not cached has
+   * no log to replay, and isn't filled here: FLAG_RELIST and 0, and the
+   * listing caches it; the log is per env, not per bucket, so this reads
+   * every change to the bucket's env after seq, not just the bucket's */
+  ChangesResult changes_since(const std::string& name, uint64_t seq,
+			      const fu2::unique_function<int(Notifiable::EventType, const std::string_view&) const>& func)
+    {
+      ChangesResult result{FLAG_NONE, seq};
+      Bucket* b = find_bucket(name);
+      if (! b) {
+	return ChangesResult{FLAG_RELIST, 0};
+      }
+
+      unique_lock ulk{b->mtx, std::adopt_lock};
+      if (! (b->flags & Bucket::FLAG_FILLED)) {
+	ulk.unlock();
+	lru.unref(b, cohort::lru::FLAG_NONE);
+	return ChangesResult{FLAG_RELIST, 0};
+      }
+      uint64_t base = b->log_base;
+      ulk.unlock();
+      /*! LOCKED */
+
+      auto& clog = *(b->clog);
+      uint64_t last = clog.committed;
+      auto txn = b->env->getROTransaction();
+      /* seq must be one this incarnation of the bucket issued: before
+       * base is an earlier one's (or another env's, or process's), and
+       * past what is committed was never issued here */
+      if ((seq < base) ||
+	  (seq > last) ||
+	  (seq + 1 < clog.low)) {
+	get<0>(result) = FLAG_RELIST;
+	get<1>(result) = last;
+      } else {
+	auto cursor=txn->getCursor(clog.dbi);
+	MDBOutVal key, data;
+	MDBInVal k(seq + 1);
+	int rc = cursor.lower_bound(k, key, data);
+	while (rc == 0) {
+	  Notifiable::EventType type;
+	  std::string_view bname, oname;
+	  Changelog::decode(data.get<string_view>(), type, bname, oname);
+	  if (bname == b->name) {
+	    (void) func(type, oname);
+	  }
+	  last = std::max(last, key.get<uint64_t>());
+	  rc = cursor.get(key, data, MDB_NEXT);
+	}
+	get<1>(result) = last;
+      }
+      lru.unref(b, cohort::lru::FLAG_NONE);
+      return result;
+    } /* changes_since */
+
+  /* events on bucket_root: a bucket directory removed, or renamed away,
+   * takes its cached listing with it; the new name (if any) fills on
+   * demand like any other uncached bucket */
+  int notify_root(const std::vector<Notifiable::Event>& evec) {
+    for (const auto& ev : evec) {
+      switch (ev.type)
+      {
+      case Notifiable::EventType::REMOVE:
+	(void) evict_bucket(std::string(*ev.name));
+	break;
+      [[unlikely]] case Notifiable::EventType::INVALIDATE:
+      {
+	/* root events lost, some buckets may be gone--check them all */
+	std::vector<std::string> names;
+	cache.for_each([&names](Bucket* b) {
+	  names.push_back(b->name);
+	}, Bucket::bucket_avl_cache::FLAG_LOCK);
+	for (const auto& name : names) {
+	  std::error_code ec;
+	  if (! sf::is_directory(rp / name, ec)) {
+	    (void) evict_bucket(name);
+	  }
+	}
+      }
+	break;
+      default:
+	break;
+      }
+    }
+    return 0;
+  } /* notify_root */
 
   int notify(const std::string& bname, void* opaque,
 	     const std::vector<Notifiable::Event>& evec) override {
-    GetBucketResult gbr = get_bucket(bname, BucketCache::FLAG_LOCK);
-    auto [b, flags] = gbr;
+    if (bname.empty()) {
+      return notify_root(evec);
+    }
+    /* opaque is the bucket's handle--holding its slot keeps the bucket
+     * from being reclaimed under the batch, without a tree lookup or an
+     * lru ref */
+    std::unique_lock<std::mutex> hlk;
+    Bucket* b = handles.resolve(opaque, hlk);
     if (b) {
-      unique_lock ulk{b->mtx, std::adopt_lock};
+      unique_lock ulk{b->mtx};
       if ((b->name != bname) ||
-	  (b != opaque) ||
+	  b->deleted() ||
 	  (! (b->flags & Bucket::FLAG_FILLED))) {
 	/* do nothing */
 	return 0;
       }
+      /* skip the echoes of write-throughs */
+      std::vector<const Notifiable::Event*> todo;
+      todo.reserve(evec.size());
+      auto now = std::chrono::steady_clock::now();
+      for (const auto& ev : evec) {
+	if ((! b->suppress.empty()) &&
+	    b->suppressed(ev, now)) {
+	  continue;
+	}
+	todo.push_back(&ev);
+      }
       ulk.unlock();
+      if (todo.empty()) {
+	return 0;
+      }
       auto txn = b->env->getRWTransaction();
-      for (const auto& ev : evec) {
+      uint32_t applied{0};
+      for (const auto* ev : todo) {
 	using EventType = Notifiable::EventType;
 	std::string_view nil{""};
 	/*std::cout << fmt::format("notify {} {}!",
-				 ev.name ? *ev.name : nil,
-				 uint32_t(ev.type))
+				 ev->name ? *ev->name : nil,
+				 uint32_t(ev->type))
 				 << std::endl; */
-	switch (ev.type)
+	switch (ev->type)
 	{
 	case EventType::ADD:
 	{
-	  auto& ev_name = *ev.name;
-	  txn->put(b->dbi, ev_name, ev_name);
+	  auto& ev_name = *ev->name;
+	  put_object_value(txn, b, ev_name);
+	  b->clog->append(txn, b->name, ev->type, ev_name);
+	  ++applied;
 	}
 	  break;
 	case EventType::REMOVE:
 	{
-	  auto& ev_name = *ev.name;
+	  auto& ev_name = *ev->name;
 	  txn->del(b->dbi, ev_name);
+	  b->clog->append(txn, b->name, ev->type, ev_name);
+	  ++applied;
+	}
+	  break;
+	case EventType::UPDATE:
+	{
+	  /* the object's value in place, if it's still there */
+	  auto& ev_name = *ev->name;
+	  ObjectMeta meta;
+	  if (metadata &&
+	      stat_meta(b, ev_name, meta)) {
+	    txn->put(b->dbi, ev_name, meta.value());
+	    b->clog->append(txn, b->name, ev->type, ev_name);
+	    ++applied;
+	  }
+	}
+	  break;
+	case EventType::REMOVE_PREFIX:
+	{
+	  /* a subtree went away, its objects with it */
+	  auto& prefix = *ev->name;
+	  auto cursor = txn->getRWCursor(b->dbi);
+	  MDBOutVal key, data;
+	  MDBInVal k(prefix);
+	  int rc = cursor.lower_bound(k, key, data);
+	  while ((rc == 0) &&
+		 key.get<string_view>().starts_with(prefix)) {
+	    cursor.del();
+	    rc = cursor.get(key, data, MDB_NEXT);
+	  }
+	  b->clog->append(txn, b->name, ev->type, prefix);
+	  ++applied;
 	}
 	  break;
 	[[unlikely]] case EventType::INVALIDATE:
 	{
 	  /* yikes, cache blown */
 	  ulk.lock();
-	  mdb_drop(*txn, b->dbi, 0); /* apparently, does not require
-				   * commit */
+	  mdb_drop(*txn, b->dbi, 0);
+	  weigh(txn, b);
+	  /* the batch's changes before this are committed too */
+	  uint64_t seq = b->clog->next;
+	  txn->commit();
+	  b->clog->publish(seq);
 	  b->flags &= ~Bucket::FLAG_FILLED;
+	  b->suppress.clear();
+	  b->gen = next_gen();
 	  return 0; /* don't process any more events in this batch */
 	}
 	  break;
@@ -401,7 +2102,17 @@ public:
 	  break;
 	}
       } /* all events */
+      if (! applied) {
+	/* the listing is as it was, and so is its generation (the txn
+	 * aborts unused) */
+	return 0;
+      }
+      b->clog->trim(txn, changelog_max);
+      uint64_t seq = b->clog->next;
+      weigh(txn, b);
       txn->commit();
+      b->clog->publish(seq);
+      b->gen = next_gen();
     } /* b */
     return 0;
   } /* notify */
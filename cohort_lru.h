@@ -13,7 +13,17 @@
 #ifndef COHORT_LRU_H
 #define COHORT_LRU_H
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 #include <boost/intrusive/list.hpp>
 #include <boost/intrusive/slist.hpp>
 #include <string.h>
@@ -33,6 +43,12 @@ namespace cohort {
     constexpr uint32_t FLAG_NONE = 0x0000;
     constexpr uint32_t FLAG_INITIAL = 0x0001;
     constexpr uint32_t FLAG_RECYCLE = 0x0002;
+    constexpr uint32_t FLAG_NOWAIT = 0x0004; /* insert: see wait_idle */
+    constexpr uint32_t FLAG_BLOCKED = 0x0008; /* insert would have waited */
+
+    /* dimensions of object weight, each with its own budget (see
+     * LRU::set_budget), their meaning up to the user */
+    constexpr int n_weights = 2;
 
     enum class Edge : std::uint8_t
     {
@@ -40,8 +56,162 @@ namespace cohort {
       LRU
     };
 
+    /* replacement policy; the non-LRU policies keep new objects in a
+     * probationary queue per lane, from which they must earn a place in
+     * the main queue, so one pass over many cold objects (a scan) only
+     * churns probation */
+    enum class Policy : std::uint8_t
+    {
+      LRU = 0,
+      S3FIFO, /* promoted if reused while on probation; ghosts readmitted */
+      TINYLFU, /* promoted if more frequent than the main queue's victim */
+      COST /* no probation; the victim is the cold object least costly
+	    * to replace for its use (GreedyDual-Size-Frequency) */
+    };
+
+    /* what insert does when the cache is full and nothing within the
+     * eviction scan is reclaimable */
+    enum class Overflow : std::uint8_t
+    {
+      WAIT = 0, /* for an object to go idle, then fail */
+      FAIL, /* insert returns nullptr */
+      OVERSHOOT /* allocate, up to max_overshoot past capacity, then WAIT */
+    };
+
     typedef bi::link_mode<bi::safe_link> link_mode;
 
+    /* count-min sketch of access frequency by object hash, 4-bit counters
+     * halved every sample_factor * capacity additions so that it forgets */
+    class FrequencySketch
+    {
+      static constexpr int depth = 4;
+      static constexpr uint32_t sample_factor = 10;
+      static constexpr uint8_t max_count = 15;
+
+      std::unique_ptr<std::atomic<uint8_t>[]> table;
+      uint32_t mask;
+      uint32_t sample;
+      std::atomic<uint32_t> additions{0};
+      std::mutex age_mtx;
+
+      static uint64_t mix(uint64_t h, int row) {
+	h += 0x9e3779b97f4a7c15ULL * (row + 1);
+	h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+	return h ^ (h >> 31);
+      }
+
+      std::atomic<uint8_t>& counter(uint64_t h, int row) {
+	return table[(row * (mask + 1)) + (mix(h, row) & mask)];
+      }
+
+      void age() {
+	std::unique_lock lk{age_mtx, std::try_to_lock};
+	if (! lk) {
+	  return; /* someone else is */
+	}
+	for (uint32_t ix = 0; ix < depth * (mask + 1); ++ix) {
+	  table[ix].store(table[ix].load(std::memory_order_relaxed) >> 1,
+			  std::memory_order_relaxed);
+	}
+	additions = 0;
+      }
+
+    public:
+      FrequencySketch(uint32_t capacity) {
+	uint32_t width = 64;
+	while (width < (capacity * 4)) {
+	  width <<= 1;
+	}
+	mask = width - 1;
+	sample = std::max(capacity, 1U) * sample_factor;
+	table.reset(new std::atomic<uint8_t>[depth * width]);
+	for (uint32_t ix = 0; ix < depth * width; ++ix) {
+	  table[ix].store(0, std::memory_order_relaxed);
+	}
+      }
+
+      void increment(uint64_t h) {
+	for (int row = 0; row < depth; ++row) {
+	  auto& c = counter(h, row);
+	  uint8_t v = c.load(std::memory_order_relaxed);
+	  while ((v < max_count) &&
+		 (! c.compare_exchange_weak(v, v + 1, std::memory_order_relaxed)))
+	    ;
+	}
+	if (++additions >= sample) {
+	  age();
+	}
+      }
+
+      uint8_t estimate(uint64_t h) {
+	uint8_t v{max_count};
+	for (int row = 0; row < depth; ++row) {
+	  v = std::min(v, counter(h, row).load(std::memory_order_relaxed));
+	}
+	return v;
+      }
+    }; /* FrequencySketch */
+
+    /* hashes of recently evicted objects, bounded and FIFO, each with
+     * its eviction sequence, so a returning object's distance tells how
+     * much larger a cache would have kept it */
+    class GhostList
+    {
+      std::mutex mtx;
+      std::deque<std::pair<uint64_t, uint64_t>> fifo; /* hash, seq */
+      std::unordered_map<uint64_t, uint64_t> members; /* hash -> seq */
+      uint64_t seq{0};
+      uint32_t capacity;
+
+      void trim() {
+	while (fifo.size() > capacity) {
+	  auto [h, s] = fifo.front();
+	  auto it = members.find(h);
+	  if ((it != members.end()) && (it->second == s)) {
+	    members.erase(it);
+	  }
+	  fifo.pop_front();
+	}
+      }
+
+    public:
+      GhostList(uint32_t capacity) : capacity(std::max(capacity, 1U)) {}
+
+      void insert(uint64_t h) {
+	std::lock_guard guard{mtx};
+	fifo.emplace_back(h, ++seq);
+	members[h] = seq;
+	trim();
+      }
+
+      /* consumes the entry, it is resident again; distance is the number
+       * of evictions since (0 for the latest) */
+      bool remove(uint64_t h, uint64_t* distance = nullptr) {
+	std::lock_guard guard{mtx};
+	auto it = members.find(h);
+	if (it == members.end()) {
+	  return false;
+	}
+	if (distance) {
+	  *distance = seq - it->second;
+	}
+	members.erase(it);
+	return true; /* its fifo slot ages out harmlessly */
+      }
+
+      void resize(uint32_t _capacity) {
+	std::lock_guard guard{mtx};
+	capacity = std::max(_capacity, 1U);
+	trim();
+      }
+
+      uint32_t get_capacity() {
+	std::lock_guard guard{mtx};
+	return capacity;
+      }
+    }; /* GhostList */
+
     class ObjectFactory; // Forward declaration
 
     class Object
@@ -50,6 +220,12 @@ namespace cohort {
       uint32_t lru_flags;
       std::atomic<uint32_t> lru_refcnt;
       std::atomic<uint32_t> lru_adj;
+      uint64_t lru_hash; /* from the factory, for the policies */
+      std::atomic<uint8_t> lru_freq; /* reuse while on probation */
+      std::atomic<uint64_t> lru_weight[n_weights]{};
+      std::atomic<uint64_t> lru_cost{1}; /* to replace, Policy::COST */
+      std::atomic<uint64_t> lru_prio{0}; /* Policy::COST */
+      std::atomic<void*> lru_lane{nullptr}; /* LRU::Lane, see lock_lane */
       bi::list_member_hook<link_mode> lru_hook;
 
       typedef bi::list<Object,
@@ -67,7 +243,8 @@ namespace cohort {
 
     public:
 
-      Object() : lru_flags(FLAG_NONE), lru_refcnt(0), lru_adj(0) {}
+      Object() : lru_flags(FLAG_NONE), lru_refcnt(0), lru_adj(0), lru_hash(0),
+		 lru_freq(0) {}
 
       uint32_t get_refcnt() const { return lru_refcnt; }
 
@@ -90,6 +267,8 @@ namespace cohort {
     public:
       virtual Object* alloc(void) = 0;
       virtual void recycle(Object*) = 0;
+      /* identifies the object to be made, across its lives */
+      virtual uint64_t hash() const { return 0; }
       virtual ~ObjectFactory() {};
     };
 
@@ -101,31 +280,154 @@ namespace cohort {
       struct Lane {
 	LK lock;
 	Object::Queue q;
-	// Object::Queue pinned; /* placeholder for possible expansion */
+	Object::Queue prob; /* probation, Policy::S3FIFO and TINYLFU */
+	Object::Queue pinned; /* never scanned for eviction, see pin */
+	std::atomic<uint64_t> clock{0}; /* inflation, Policy::COST */
 	CACHE_PAD(0);
 	Lane() {}
       };
 
-      Lane *qlane;
-      int n_lanes;
+      /* set_lanes replaces the lanes whole; a set stays allocated until
+       * the LRU goes, as a thread may still hold one it loaded before */
+      struct LaneSet {
+	int n;
+	std::unique_ptr<Lane[]> lane;
+	LaneSet(int n) : n(n), lane(new Lane[n]) {}
+      };
+
+      std::atomic<LaneSet*> qlane;
+      /* the lane count (high half) and the per-lane hiwat (low half),
+       * published together so that capacity() never mixes a new count
+       * with an old hiwat (see set_lanes) */
+      std::atomic<uint64_t> shape;
+      std::mutex resize_mtx;
+      std::vector<std::unique_ptr<LaneSet>> lane_sets; /* resize_mtx */
       std::atomic<uint32_t> evict_lane;
-      const uint32_t lane_hiwat;
+      const Policy policy;
+      std::atomic<uint32_t> prob_hiwat; /* per lane */
+      std::atomic<uint32_t> n_objects;
+      std::unique_ptr<FrequencySketch> sketch; /* TINYLFU */
+      std::unique_ptr<GhostList> ghosts; /* S3FIFO */
+
+      /* evictions by every policy, for the miss curve (see miss_curve) */
+      static constexpr uint32_t mrc_bins = 16;
+      std::unique_ptr<GhostList> history;
+      std::atomic<uint64_t> n_hits{0};
+      std::atomic<uint64_t> n_misses{0};
+      std::atomic<uint64_t> ghost_hits[mrc_bins]{}; /* by distance */
+
+      /* reclaimed objects, ready for insert (see evict_free) */
+      LK free_lock;
+      Object::Queue free_q;
+      std::atomic<uint32_t> n_free;
+
+      /* eviction scan and overflow (see set_overflow) */
+      std::atomic<uint32_t> evict_depth{8}; /* candidates per queue */
+      std::atomic<Overflow> overflow{Overflow::OVERSHOOT};
+      std::atomic<uint32_t> max_overshoot;
+      std::atomic<int64_t> overflow_wait_ms{1000};
+      std::atomic<uint64_t> n_overshoots{0};
+      std::atomic<uint64_t> n_waits{0};
+      std::atomic<uint64_t> n_fails{0};
+      std::atomic<uint32_t> overshoot_max{0};
+
+      /* inserts waiting for an object to go idle */
+      std::mutex idle_mtx;
+      std::condition_variable idle_cv;
+      uint64_t idle_seq{0}; /* idle_mtx */
+      std::atomic<uint32_t> waiters{0};
+
+      std::atomic<uint64_t> total_weight[n_weights]{};
+      std::atomic<uint64_t> weight_budget[n_weights]{};
+
+      std::atomic<uint32_t> n_pinned{0};
+      std::atomic<uint32_t> pin_budget{0}; /* see set_pin_budget */
 
       static constexpr uint32_t lru_adj_modulus = 5;
 
+      /* objects moved per lane lock, see set_lanes */
+      static constexpr uint32_t relane_batch = 64;
+
       static constexpr uint32_t SENTINEL_REFCNT = 1;
 
+      /* the probation share of a lane, S3-FIFO's small queue */
+      static constexpr uint32_t prob_pct = 10;
+      /* reuse counted while on probation */
+      static constexpr uint8_t max_freq = 3;
+
       /* internal flag values */
       static constexpr uint32_t FLAG_INLRU = 0x0001;
-      static constexpr uint32_t FLAG_PINNED  = 0x0002; // possible future use
+      static constexpr uint32_t FLAG_PINNED  = 0x0002; /* see pin */
       static constexpr uint32_t FLAG_EVICTING = 0x0004;
+      static constexpr uint32_t FLAG_PROBATION = 0x0008;
+
+      /* o's lane, unlocked--o may move to another meanwhile */
+      Lane& lane_of(Object* o) {
+	return *static_cast<Lane*>(o->lru_lane.load());
+      }
+
+      /* o's lane, LOCKED; o only moves under its lane lock (set_lanes);
+       * a recycle racing a late unref clears the lane until insert sets
+       * it again */
+      Lane& lock_lane(Object* o) {
+	for (;;) {
+	  Lane* lane = static_cast<Lane*>(o->lru_lane.load());
+	  if (! lane) [[unlikely]] {
+	    std::this_thread::yield();
+	    continue;
+	  }
+	  lane->lock.lock();
+	  if (o->lru_lane == lane) {
+	    return *lane;
+	  }
+	  lane->lock.unlock();
+	}
+      }
+
+      /* the lane a new object joins, LOCKED; a lane is only drained by
+       * set_lanes once its set is replaced, so o must not join a lane
+       * of a replaced set */
+      Lane& lock_new_lane(Object* o) {
+	for (;;) {
+	  LaneSet* ls = qlane;
+	  Lane& lane = ls->lane[(uint64_t)(o) % ls->n];
+	  lane.lock.lock();
+	  if (qlane == ls) {
+	    o->lru_lane = &lane;
+	    return lane;
+	  }
+	  lane.lock.unlock();
+	}
+      }
 
-      Lane& lane_of(void* addr) {
-	return qlane[(uint64_t)(addr) % n_lanes];
+      /* LOCKED src; moves up to n objects from the MRU end of src's
+       * queues to the LRU end of the same queues of their lanes in ls,
+       * keeping their order; returns the number moved */
+      uint32_t relane(Lane& src, LaneSet* ls, uint32_t n) {
+	uint32_t moved{0};
+	for (Object::Queue* q : {&src.q, &src.prob, &src.pinned}) {
+	  while ((moved < n) && (! q->empty())) {
+	    Object* o = &(q->front());
+	    q->pop_front();
+	    Lane& dst = ls->lane[(uint64_t)(o) % ls->n];
+	    std::lock_guard dst_lock{dst.lock};
+	    queue_of(dst, o).push_back(*o);
+	    o->lru_lane = &dst;
+	    ++moved;
+	  }
+	}
+	return moved;
+      }
+
+      Object::Queue& queue_of(Lane& lane, Object* o) {
+	if (o->lru_flags & FLAG_PINNED) {
+	  return lane.pinned;
+	}
+	return (o->lru_flags & FLAG_PROBATION) ? lane.prob : lane.q;
       }
 
-      uint32_t next_evict_lane() {
-	return (evict_lane++ % n_lanes);
+      uint32_t next_evict_lane(int n) {
+	return (evict_lane++ % n);
       }
 
       bool can_reclaim(Object* o) {
@@ -133,20 +435,204 @@ namespace cohort {
 		(!(o->lru_flags & FLAG_EVICTING)));
       }
 
+      /* LOCKED lane; the first reclaimable object from the cold end of
+       * q, looking no further than evict_depth */
+      Object* scan(Object::Queue& q) {
+	uint32_t depth = evict_depth;
+	for (auto it = q.rbegin(); (it != q.rend()) && (depth > 0);
+	     ++it, --depth) {
+	  if (can_reclaim(&(*it))) {
+	    return &(*it);
+	  }
+	}
+	return nullptr;
+      }
+
+      /* LOCKED lane; of the reclaimable objects within evict_depth of the
+       * cold end of q, the one of least priority (Policy::COST) */
+      Object* cheapest(Object::Queue& q) {
+	uint32_t depth = evict_depth;
+	Object* v{nullptr};
+	for (auto it = q.rbegin(); (it != q.rend()) && (depth > 0);
+	     ++it, --depth) {
+	  Object* o = &(*it);
+	  if (can_reclaim(o) && ((! v) || (o->lru_prio < v->lru_prio))) {
+	    v = o;
+	  }
+	}
+	return v;
+      }
+
+      /* GreedyDual: an object is worth the lane's clock when last used,
+       * plus its uses times its cost, and the clock advances to each
+       * victim's worth, so that what is cheap or long unused goes first */
+      void prioritize(Lane& lane, Object* o) {
+	uint64_t uses = std::max(o->lru_adj.load(), 1U);
+	o->lru_prio = lane.clock + (uses * o->lru_cost);
+      }
+
+      uint32_t bin_width() {
+	return (history->get_capacity() + mrc_bins - 1) / mrc_bins;
+      }
+
+      bool probation() const {
+	return (policy == Policy::S3FIFO) || (policy == Policy::TINYLFU);
+      }
+
+      /* LOCKED lane; moves o from probation to the MRU end of the main
+       * queue */
+      void promote(Lane& lane, Object* o) {
+	lane.prob.erase(Object::Queue::s_iterator_to(*o));
+	o->lru_flags &= ~FLAG_PROBATION;
+	o->lru_freq = 0;
+	lane.q.push_front(*o);
+      }
+
+      /* LOCKED lane; the object to try to reclaim from lane, or nullptr;
+       * under S3FIFO and TINYLFU, probation is drained first while it is
+       * at its share (the new object is about to join it) or over, and
+       * survivors are promoted on the way */
+      Object* victim(Lane& lane) {
+	if (policy == Policy::LRU) {
+	  return scan(lane.q);
+	}
+	if (policy == Policy::COST) {
+	  return cheapest(lane.q);
+	}
+	for (uint32_t ix = 0; ix <= prob_hiwat; ++ix) {
+	  Object* m = scan(lane.q);
+	  if ((lane.prob.size() < prob_hiwat) && m) {
+	    return m;
+	  }
+	  Object* c = scan(lane.prob);
+	  if (! c) {
+	    return m;
+	  }
+	  switch (policy) {
+	  case Policy::S3FIFO:
+	    /* reused while on probation */
+	    if (c->lru_freq > 0) {
+	      promote(lane, c);
+	      continue;
+	    }
+	    return c;
+	  case Policy::TINYLFU:
+	    /* admit the candidate only if it is seen more often than what
+	     * it would displace */
+	    if (m &&
+		(sketch->estimate(c->lru_hash) > sketch->estimate(m->lru_hash))) {
+	      promote(lane, c);
+	      return m;
+	    }
+	    return c;
+	  default:
+	    abort();
+	  }
+	}
+	return scan(lane.q);
+      } /* victim */
+
+      Object* take_free() {
+	if (n_free == 0) {
+	  return nullptr;
+	}
+	std::lock_guard guard{free_lock};
+	if (free_q.empty()) {
+	  return nullptr;
+	}
+	Object* o = &(free_q.front());
+	free_q.pop_front();
+	--n_free;
+	return o;
+      }
+
+      /* o is leaving the cache */
+      void unweigh(Object* o) {
+	for (int dim = 0; dim < n_weights; ++dim) {
+	  total_weight[dim] -= o->lru_weight[dim].exchange(0);
+	}
+      }
+
+      /* full by count or by weight */
+      bool full() const {
+	return (n_objects >= capacity()) || over_budget();
+      }
+
+      /* wakes inserts waiting in overflow_block */
+      void idle_signal() {
+	std::lock_guard guard{idle_mtx};
+	++idle_seq;
+	idle_cv.notify_all();
+      }
+
+      /* full, and nothing was reclaimable: true to allocate past capacity,
+       * otherwise o is what was reclaimed while waiting, or nullptr; with
+       * FLAG_NOWAIT, flags gets FLAG_BLOCKED instead of waiting */
+      bool overflow_block(const ObjectFactory* newobj_fac, Object*& o,
+			  uint32_t& flags) {
+	Overflow ov = overflow;
+	if ((ov == Overflow::OVERSHOOT) &&
+	    (n_objects < (capacity() + max_overshoot))) {
+	  ++n_overshoots;
+	  return true;
+	}
+	if (ov == Overflow::FAIL) {
+	  ++n_fails;
+	  return false;
+	}
+	/* WAIT, or overshot as far as allowed */
+	if (flags & FLAG_NOWAIT) {
+	  flags |= FLAG_BLOCKED;
+	  return false;
+	}
+	++n_waits;
+	o = wait_block(newobj_fac, wait_deadline());
+	if (! o) {
+	  ++n_fails;
+	}
+	return false;
+      } /* overflow_block */
+
+      /* for an object to go idle and be reclaimed, until deadline */
+      Object* wait_block(const ObjectFactory* newobj_fac,
+			 std::chrono::steady_clock::time_point deadline) {
+	Object* o{nullptr};
+	std::unique_lock lk{idle_mtx};
+	++waiters;
+	for (;;) {
+	  uint64_t seq = idle_seq;
+	  lk.unlock();
+	  o = take_free();
+	  if (! o) {
+	    o = evict_block(newobj_fac);
+	  }
+	  lk.lock();
+	  if (o ||
+	      (! idle_cv.wait_until(lk, deadline, [this, seq]{
+		return idle_seq != seq; }))) {
+	    break;
+	  }
+	}
+	--waiters;
+	return o;
+      } /* wait_block */
+
       Object* evict_block(const ObjectFactory* newobj_fac) {
-	uint32_t lane_ix = next_evict_lane();
-	for (int ix = 0; ix < n_lanes; ++ix,
-	       lane_ix = next_evict_lane()) {
-	  Lane& lane = qlane[lane_ix];
+	LaneSet* ls = qlane;
+	uint32_t lane_ix = next_evict_lane(ls->n);
+	for (int ix = 0; ix < ls->n; ++ix,
+	       lane_ix = next_evict_lane(ls->n)) {
+	  Lane& lane = ls->lane[lane_ix];
 	  std::unique_lock lane_lock{lane.lock};
 	  /* if object at LRU has refcnt==1, it may be reclaimable */
-	  Object* o = &(lane.q.back());
-	  if (can_reclaim(o)) {
+	  Object* o = victim(lane);
+	  if (o && can_reclaim(o)) {
 	    ++(o->lru_refcnt);
 	    o->lru_flags |= FLAG_EVICTING;
 	    lane_lock.unlock();
 	    if (o->reclaim(newobj_fac)) {
-	      lane_lock.lock();
+	      /* o may have been moved meanwhile (set_lanes) */
+	      Lane& olane = lock_lane(o);
 	      --(o->lru_refcnt);
 	      /* assertions that o state has not changed across
 	       * relock */
@@ -154,7 +640,18 @@ namespace cohort {
 	      //ceph_assert(o->lru_flags & FLAG_INLRU);
 	      Object::Queue::iterator it =
 		Object::Queue::s_iterator_to(*o);
-	      lane.q.erase(it);
+	      queue_of(olane, o).erase(it);
+	      unweigh(o);
+	      if (o->lru_hash) {
+		history->insert(o->lru_hash);
+	      }
+	      if ((policy == Policy::COST) && (o->lru_prio > olane.clock)) {
+		olane.clock = o->lru_prio.load();
+	      }
+	      if (ghosts && (o->lru_flags & FLAG_PROBATION)) {
+		ghosts->insert(o->lru_hash);
+	      }
+	      olane.lock.unlock();
 	      return o;
 	    } else {
 	      --(o->lru_refcnt);
@@ -168,28 +665,419 @@ namespace cohort {
 
     public:
 
-      LRU(int lanes, uint32_t _hiwat)
-	: n_lanes(lanes), evict_lane(0), lane_hiwat(_hiwat)
+      LRU(int lanes, uint32_t _hiwat, Policy _policy = Policy::LRU)
+	: shape((uint64_t(lanes) << 32) | _hiwat), evict_lane(0), policy(_policy),
+	  prob_hiwat(std::max((_hiwat * prob_pct) / 100, 1U)), n_objects(0),
+	  n_free(0), max_overshoot(lanes * _hiwat)
+	  {
+	    //ceph_assert(lanes > 0);
+	    lane_sets.push_back(std::make_unique<LaneSet>(lanes));
+	    qlane = lane_sets.back().get();
+	    switch (policy) {
+	    case Policy::S3FIFO:
+	      ghosts = std::make_unique<GhostList>(capacity());
+	      break;
+	    case Policy::TINYLFU:
+	      sketch = std::make_unique<FrequencySketch>(capacity());
+	      break;
+	    default:
+	      break;
+	    }
+	    history = std::make_unique<GhostList>(capacity());
+	  }
+
+
+      Policy get_policy() const { return policy; }
+
+      uint32_t size() const { return n_objects; }
+
+      uint32_t capacity() const {
+	uint64_t sh = shape;
+	return uint32_t(sh >> 32) * uint32_t(sh);
+      }
+
+    private:
+      /* resize_mtx */
+      void reshape(uint32_t lanes, uint32_t cap) {
+	uint32_t hiwat = std::max(cap / lanes, 1U);
+	shape = (uint64_t(lanes) << 32) | hiwat;
+	prob_hiwat = std::max((hiwat * prob_pct) / 100, 1U);
+	if (ghosts) {
+	  ghosts->resize(capacity());
+	}
+	reset_curve();
+      }
+
+    public:
+      /* rounded down to a multiple of the lanes (at least one each); a
+       * smaller capacity is reached as objects are evicted (evict_free) */
+      void set_capacity(uint32_t cap) {
+	std::lock_guard guard{resize_mtx};
+	reshape(get_lanes(), cap);
+      }
+
+      int get_lanes() const { return int(shape >> 32); }
+
+      /* moves every object to a new set of lanes, relane_batch at a time
+       * per lane lock, so that no lane is held for long; capacity is kept,
+       * rounded as by set_capacity; concurrent operations go on */
+      void set_lanes(int lanes) {
+	std::lock_guard guard{resize_mtx};
+	LaneSet* old = qlane;
+	if ((lanes < 1) || (lanes == old->n)) {
+	  return;
+	}
+	lane_sets.push_back(std::make_unique<LaneSet>(lanes));
+	LaneSet* ls = lane_sets.back().get();
+	/* priorities carry over (Policy::COST) */
+	uint64_t clock{0};
+	for (int ix = 0; ix < old->n; ++ix) {
+	  clock = std::max(clock, old->lane[ix].clock.load());
+	}
+	for (int ix = 0; ix < lanes; ++ix) {
+	  ls->lane[ix].clock = clock;
+	}
+	/* the new lanes first, then their count and hiwat at once */
+	qlane = ls;
+	reshape(lanes, capacity());
+	for (int ix = 0; ix < old->n; ++ix) {
+	  Lane& src = old->lane[ix];
+	  for (;;) {
+	    {
+	      std::lock_guard src_lock{src.lock};
+	      if (relane(src, ls, relane_batch) < relane_batch) {
+		break;
+	      }
+	    }
+	    std::this_thread::yield();
+	  }
+	}
+      } /* set_lanes */
+
+      bool over_capacity() const {
+	return (n_objects - n_free) > capacity();
+      }
+
+      /* the miss ratio at a cache size, see miss_curve */
+      struct CurvePoint
+      {
+	uint32_t size;
+	double miss_ratio;
+      };
+
+      /* since reset_curve, the miss ratio at capacity, and at each larger
+       * size the history reaches, estimated from how recently each missed
+       * object had been evicted */
+      std::vector<CurvePoint> miss_curve() {
+	uint64_t misses = n_misses;
+	uint64_t total = n_hits + misses;
+	uint32_t width = bin_width();
+	auto ratio = [total](uint64_t m) {
+	  return total ? (double(m) / double(total)) : 0.0;
+	};
+	std::vector<CurvePoint> curve;
+	curve.push_back(CurvePoint{capacity(), ratio(misses)});
+	for (uint32_t bin = 0; bin < mrc_bins; ++bin) {
+	  misses -= std::min(misses, ghost_hits[bin].load());
+	  curve.push_back(CurvePoint{capacity() + ((bin + 1) * width),
+				     ratio(misses)});
+	}
+	return curve;
+      }
+
+      /* accesses counted in miss_curve */
+      uint64_t curve_samples() const { return n_hits + n_misses; }
+
+      void reset_curve() {
+	n_hits = 0;
+	n_misses = 0;
+	for (auto& hits : ghost_hits) {
+	  hits = 0;
+	}
+      }
+
+      /* how many evictions back the miss curve sees (by default,
+       * capacity at construction) */
+      void track_misses(uint32_t depth) {
+	history->resize(depth);
+	reset_curve();
+      }
+
+      struct Counts
+      {
+	uint32_t objects{0};
+	uint32_t capacity{0};
+	uint32_t free{0}; /* reclaimed, ready for insert */
+	uint32_t overshoot{0}; /* objects past capacity now */
+	uint32_t overshoot_max{0};
+	uint64_t overshoots{0}; /* inserts allowed past capacity */
+	uint64_t waits{0}; /* inserts that waited for an idle object */
+	uint64_t fails{0}; /* inserts refused */
+	uint32_t pinned{0};
+	uint32_t pin_budget{0};
+	uint64_t weight[n_weights]{};
+	uint64_t budget[n_weights]{};
+      };
+
+      Counts counts() const {
+	Counts c;
+	c.objects = n_objects;
+	c.capacity = capacity();
+	c.free = n_free;
+	c.overshoot = (c.objects > c.capacity) ? (c.objects - c.capacity) : 0;
+	c.overshoot_max = overshoot_max;
+	c.overshoots = n_overshoots;
+	c.waits = n_waits;
+	c.fails = n_fails;
+	c.pinned = n_pinned;
+	c.pin_budget = pin_budget;
+	for (int dim = 0; dim < n_weights; ++dim) {
+	  c.weight[dim] = total_weight[dim];
+	  c.budget[dim] = weight_budget[dim];
+	}
+	return c;
+      }
+
+      /* how far evict_block looks from the cold end of each queue */
+      void set_evict_depth(uint32_t depth) {
+	evict_depth = std::max(depth, 1U);
+      }
+
+      /* what insert does when the cache is full and nothing is
+       * reclaimable: OVERSHOOT allows up to max objects past capacity (by
+       * default, capacity again); WAIT, and OVERSHOOT beyond that, wait up
+       * to wait for an object to go idle */
+      void set_overflow(Overflow ov, uint32_t max,
+			std::chrono::milliseconds wait) {
+	overflow = ov;
+	max_overshoot = max;
+	overflow_wait_ms = wait.count();
+      }
+
+      /* inserts possible without reclaiming inline: the free pool, and
+       * whatever is left below capacity */
+      uint32_t headroom() const {
+	uint32_t n = n_objects;
+	if (over_budget()) {
+	  return n_free;
+	}
+	return n_free + ((n < capacity()) ? (capacity() - n) : 0);
+      }
+
+      /* o's weight in dimension dim (the caller holds a ref) */
+      void set_weight(Object* o, int dim, uint64_t w) {
+	uint64_t old = o->lru_weight[dim].exchange(w);
+	total_weight[dim] += (w - old);
+      }
+
+      uint64_t weight(int dim) const { return total_weight[dim]; }
+
+      /* the most objects pinned at once; lowering it unpins nothing, but
+       * refuses pins until enough are unpinned */
+      void set_pin_budget(uint32_t budget) {
+	pin_budget = budget;
+      }
+
+      /* keeps o (the caller holds a ref) out of eviction until unpin, on
+       * its lane's pinned queue, still counted against capacity; false
+       * when the pin budget is spent, or o is being evicted */
+      bool pin(Object* o) {
+	Lane& lane = lock_lane(o);
+	bool ok{true};
+	if (! (o->lru_flags & FLAG_PINNED)) {
+	  /* other lanes pin concurrently */
+	  uint32_t n = n_pinned;
+	  do {
+	    if ((o->lru_flags & FLAG_EVICTING) || (n >= pin_budget)) {
+	      ok = false;
+	      break;
+	    }
+	  } while (! n_pinned.compare_exchange_weak(n, n + 1));
+	  if (ok) {
+	    queue_of(lane, o).erase(Object::Queue::s_iterator_to(*o));
+	    o->lru_flags &= ~FLAG_PROBATION;
+	    o->lru_flags |= FLAG_PINNED;
+	    lane.pinned.push_front(*o);
+	  }
+	}
+	lane.lock.unlock();
+	return ok;
+      } /* pin */
+
+      /* back to the MRU end of its lane's main queue, if pinned */
+      void unpin(Object* o) {
+	Lane& lane = lock_lane(o);
+	if (o->lru_flags & FLAG_PINNED) {
+	  lane.pinned.erase(Object::Queue::s_iterator_to(*o));
+	  o->lru_flags &= ~FLAG_PINNED;
+	  lane.q.push_front(*o);
+	  --n_pinned;
+	}
+	lane.lock.unlock();
+      } /* unpin */
+
+      bool pinned(Object* o) const {
+	return (o->lru_flags & FLAG_PINNED);
+      }
+
+      /* what it costs to replace o, in the user's units (Policy::COST);
+       * the caller holds a ref */
+      void set_cost(Object* o, uint64_t cost) {
+	o->lru_cost = std::max(cost, uint64_t(1));
+	if (policy == Policy::COST) {
+	  prioritize(lane_of(o), o);
+	}
+      }
+
+      /* the most total weight in dimension dim, 0 for no limit; may
+       * change at any time, and is enforced by insert and evict_free */
+      void set_budget(int dim, uint64_t budget) {
+	weight_budget[dim] = budget;
+      }
+
+      bool over_budget() const {
+	for (int dim = 0; dim < n_weights; ++dim) {
+	  uint64_t budget = weight_budget[dim];
+	  if (budget && (total_weight[dim] > budget)) {
+	    return true;
+	  }
+	}
+	return false;
+      }
+
+      /* when an insert with FLAG_NOWAIT would wait */
+      std::chrono::steady_clock::time_point wait_deadline() const {
+	return std::chrono::steady_clock::now() +
+	  std::chrono::milliseconds(overflow_wait_ms);
+      }
+
+      /* the wait of an insert that returned FLAG_BLOCKED, for a caller
+       * that held a lock an object's reclaim() may need, and has dropped
+       * it: waits until deadline for an object to go idle, and reclaims it
+       * (with a null newobj_fac) into the free pool for the retried
+       * insert; false if none did */
+      bool wait_idle(std::chrono::steady_clock::time_point deadline) {
+	++n_waits;
+	Object* o = wait_block(nullptr, deadline);
+	if (! o) {
+	  ++n_fails;
+	  return false;
+	}
+	{
+	  std::lock_guard guard{free_lock};
+	  free_q.push_back(*o);
+	  ++n_free;
+	}
+	return true;
+      } /* wait_idle */
+
+      /* reclaims idle objects into the free pool until headroom is at
+       * least hiwat and the cache is within budget and capacity, or
+       * nothing more is reclaimable, for a background thread; each
+       * object's reclaim() sees a null newobj_fac; returns the number
+       * reclaimed */
+      uint32_t evict_free(uint32_t hiwat) {
+	uint32_t n{0};
+	while ((headroom() < hiwat) || over_budget() || over_capacity()) {
+	  Object* o = evict_block(nullptr);
+	  if (! o) {
+	    break;
+	  }
 	  {
-	    //ceph_assert(n_lanes > 0);
-	    qlane = new Lane[n_lanes];
+	    std::lock_guard guard{free_lock};
+	    free_q.push_back(*o);
+	    ++n_free;
+	  }
+	  ++n;
+	  if (waiters > 0) {
+	    idle_signal();
 	  }
+	}
+	return n;
+      } /* evict_free */
+
+      /* drops the caller's ref on o, which its owner has unindexed, so
+       * that no new ref can come: if that leaves o idle (and unpinned),
+       * o is reclaimed (reclaim() sees a null newobj_fac) into the free
+       * pool at once, leaving capacity and weight; otherwise it goes to
+       * the cold end of its queue, to be the next evicted once idle;
+       * true if reclaimed */
+      bool retire(Object* o) {
+	Lane& lane = lock_lane(o);
+	if ((o->lru_refcnt == (SENTINEL_REFCNT + 1)) &&
+	    (! (o->lru_flags & (FLAG_PINNED | FLAG_EVICTING)))) {
+	  /* our ref now holds o, as evict_block's does */
+	  o->lru_flags |= FLAG_EVICTING;
+	  lane.lock.unlock();
+	  bool reclaimed = o->reclaim(nullptr);
+	  Lane& olane = lock_lane(o);
+	  o->lru_flags &= ~FLAG_EVICTING;
+	  if (reclaimed) {
+	    --(o->lru_refcnt);
+	    queue_of(olane, o).erase(Object::Queue::s_iterator_to(*o));
+	    unweigh(o);
+	    olane.lock.unlock();
+	    {
+	      std::lock_guard guard{free_lock};
+	      free_q.push_back(*o);
+	      ++n_free;
+	    }
+	    if (waiters > 0) {
+	      idle_signal();
+	    }
+	    return true;
+	  }
+	  olane.lock.unlock();
+	  return retire_cold(o);
+	}
+	lane.lock.unlock();
+	return retire_cold(o);
+      } /* retire */
+
+    private:
+      /* retire, for an o still busy: to the cold end, and unref */
+      bool retire_cold(Object* o) {
+	Lane& lane = lock_lane(o);
+	if (! (o->lru_flags & FLAG_PINNED)) {
+	  Object::Queue& q = queue_of(lane, o);
+	  q.erase(Object::Queue::s_iterator_to(*o));
+	  q.push_back(*o);
+	}
+	lane.lock.unlock();
+	unref(o, FLAG_NONE);
+	return false;
+      }
 
-      ~LRU() { delete[] qlane; }
+    public:
 
       bool ref(Object* o, uint32_t flags) {
 	++(o->lru_refcnt);
 	if (flags & FLAG_INITIAL) {
-	  if ((++(o->lru_adj) % lru_adj_modulus) == 0) {
-	    Lane& lane = lane_of(o);
-	    lane.lock.lock();
-	    /* move to MRU */
-	    Object::Queue::iterator it =
-	      Object::Queue::s_iterator_to(*o);
-	    lane.q.erase(it);
-	    lane.q.push_front(*o);
+	  ++n_hits;
+	  if (sketch) {
+	    sketch->increment(o->lru_hash);
+	  }
+	  if (o->lru_flags & FLAG_PROBATION) {
+	    /* stays put; reuse counts toward promotion */
+	    uint8_t freq = o->lru_freq.load(std::memory_order_relaxed);
+	    if (freq < max_freq) {
+	      o->lru_freq.store(freq + 1, std::memory_order_relaxed);
+	    }
+	  } else if ((++(o->lru_adj) % lru_adj_modulus) == 0) {
+	    Lane& lane = lock_lane(o);
+	    /* move to MRU, unless promoted, pinned or evicted meanwhile */
+	    if (! (o->lru_flags & (FLAG_PROBATION | FLAG_PINNED))) {
+	      Object::Queue::iterator it =
+		Object::Queue::s_iterator_to(*o);
+	      lane.q.erase(it);
+	      lane.q.push_front(*o);
+	    }
 	    lane.lock.unlock();
 	  } /* adj */
+	  if (policy == Policy::COST) {
+	    /* with this use */
+	    prioritize(lane_of(o), o);
+	  }
 	} /* initial ref */
 	return true;
       } /* ref */
@@ -198,34 +1086,29 @@ namespace cohort {
 	uint32_t refcnt = --(o->lru_refcnt);
 	Object* tdo = nullptr;
 	if (refcnt == 0) [[unlikely]] {
-	  Lane& lane = lane_of(o);
-	  lane.lock.lock();
+	  Lane& lane = lock_lane(o);
 	  refcnt = o->lru_refcnt.load();
 	  if (refcnt == 0) [[unlikely]] {
 	    Object::Queue::iterator it =
 	      Object::Queue::s_iterator_to(*o);
-	    lane.q.erase(it);
-	    tdo = o;
-	  }
-	  lane.lock.unlock();
-	} else if (refcnt == SENTINEL_REFCNT) [[unlikely]] {
-	  Lane& lane = lane_of(o);
-	  lane.lock.lock();
-	  refcnt = o->lru_refcnt.load();
-	  if (refcnt == SENTINEL_REFCNT) [[likely]] {
-	    /* move to LRU */
-	    Object::Queue::iterator it =
-	      Object::Queue::s_iterator_to(*o);
-	    lane.q.erase(it);
-	    /* hiwat check */
-	    if (lane.q.size() > lane_hiwat) {
-	      tdo = o;
-	    } else {
-	      lane.q.push_back(*o);
+	    queue_of(lane, o).erase(it);
+	    --n_objects;
+	    if (o->lru_flags & FLAG_PINNED) {
+	      --n_pinned;
 	    }
+	    unweigh(o);
+	    tdo = o;
 	  }
 	  lane.lock.unlock();
 	}
+	/* an object going idle keeps its place, under every policy: ref
+	 * ordered it by use, and the eviction scan (evict_depth) passes over
+	 * busy objects at the cold end, so idle ones needn't be moved there
+	 * to be found; capacity is enforced by evict_block, an idle object
+	 * is still indexed by its owner and can't just be deleted here */
+	if ((refcnt == SENTINEL_REFCNT) && (waiters > 0)) [[unlikely]] {
+	  idle_signal();
+	}
 	/* unref out-of-line && !LOCKED */
 	if (tdo)
 	  delete tdo;
@@ -233,30 +1116,74 @@ namespace cohort {
 
       Object* insert(ObjectFactory* fac, Edge edge, uint32_t& flags) {
 	/* use supplied functor to re-use an evicted object, or
-	 * allocate a new one of the descendant type */
-	Object* o = evict_block(fac);
+	 * allocate a new one of the descendant type; there is nothing to
+	 * evict until the cache is full */
+	Object* o = take_free();
+	if ((! o) && full()) {
+	  o = evict_block(fac);
+	  if ((! o) && (! overflow_block(fac, o, flags)) && (! o)) {
+	    /* full, and overflow_block reclaimed nothing either */
+	    return nullptr;
+	  }
+	}
 	if (o) {
 	  fac->recycle(o); /* recycle existing object */
 	  flags |= FLAG_RECYCLE;
 	}
-	else
+	else {
 	  o = fac->alloc(); /* get a new one */
+	  uint32_t n = ++n_objects;
+	  uint32_t over = overshoot_max;
+	  while ((n > capacity()) && ((n - capacity()) > over) &&
+		 (! overshoot_max.compare_exchange_weak(over, n - capacity())))
+	    ;
+	}
 
 	o->lru_flags = FLAG_INLRU;
+	o->lru_hash = fac->hash();
+	o->lru_freq = 0;
+	++n_misses;
+	uint64_t distance;
+	if (o->lru_hash && history->remove(o->lru_hash, &distance)) {
+	  uint64_t bin = distance / bin_width();
+	  if (bin < mrc_bins) {
+	    ++ghost_hits[bin];
+	  }
+	}
+	if (sketch) {
+	  sketch->increment(o->lru_hash);
+	}
+	/* new objects start on probation, unless recently evicted from
+	 * it (S3FIFO) */
+	if (probation() &&
+	    (! (ghosts && ghosts->remove(o->lru_hash)))) {
+	  o->lru_flags |= FLAG_PROBATION;
+	}
 
-	Lane& lane = lane_of(o);
-	lane.lock.lock();
+	Lane& lane = lock_new_lane(o);
+	if (policy == Policy::COST) {
+	  prioritize(lane, o);
+	}
+	Object::Queue& q = queue_of(lane, o);
 	switch (edge) {
 	case Edge::MRU:
-	  lane.q.push_front(*o);
+	  q.push_front(*o);
 	  break;
 	case Edge::LRU:
-	  lane.q.push_back(*o);
+	  q.push_back(*o);
 	  break;
 	default:
 	  abort();
 	  break;
 	}
+	/* TINYLFU: while the main queue is short of its share, probation
+	 * overflows into it unopposed, so that eviction has a main victim
+	 * for candidates to contest */
+	if ((policy == Policy::TINYLFU) &&
+	    (lane.prob.size() > prob_hiwat) &&
+	    ((lane.q.size() + prob_hiwat) < uint32_t(shape))) {
+	  promote(lane, &(lane.prob.back()));
+	}
 	if (flags & FLAG_INITIAL)
 	  o->lru_refcnt += 2; /* sentinel ref + initial */
 	else
@@ -283,8 +1210,8 @@ namespace cohort {
       typedef typename TTree::iterator iterator;
       typedef std::pair<iterator, bool> check_result;
       typedef typename TTree::insert_commit_data insert_commit_data;
-      int n_part;
-      int csz;
+      std::atomic<int> n_part;
+      std::atomic<int> csz;
 
       typedef std::unique_lock<LK> unique_lock;
 
@@ -293,6 +1220,8 @@ namespace cohort {
 	TTree tr;
 	T** cache;
 	int csz;
+	/* its elements are in the next table (rehash) */
+	std::atomic<bool> moved{false};
 	CACHE_PAD(0);
 
 	Partition() : tr(), cache(nullptr), csz(0) {}
@@ -303,6 +1232,32 @@ namespace cohort {
 	}
       };
 
+      /* rehash replaces the partitions whole; a table stays allocated
+       * until the TreeX goes, as a thread may still hold one it loaded
+       * before, and leads to its successor */
+      struct Table {
+	int n_part;
+	Partition* part;
+	std::atomic<Table*> next{nullptr};
+
+	Table(int n_part, int csz) : n_part(n_part) {
+	  part = new Partition[n_part];
+	  for (int ix = 0; ix < n_part; ++ix) {
+	    Partition& p = part[ix];
+	    if (csz) {
+	      p.csz = csz;
+	      p.cache = (T**) ::operator new(csz * sizeof(T*));
+	      // FIPS zeroization audit 20191115: this memset is not security related.
+	      memset(p.cache, 0, csz * sizeof(T*));
+	    }
+	  }
+	}
+
+	~Table() {
+	  delete[] part;
+	}
+      };
+
       struct Latch {
 	Partition* p;
 	LK* lock;
@@ -311,19 +1266,59 @@ namespace cohort {
 	Latch() : p(nullptr), lock(nullptr) {}
       };
 
+      /* the partition holding x, unlocked--a rehash may move it
+       * meanwhile */
       Partition& partition_of_scalar(uint64_t x) {
-	return part[x % n_part];
+	Table* t = tab;
+	Partition* p = &(t->part[x % t->n_part]);
+	while (p->moved) {
+	  t = t->next;
+	  p = &(t->part[x % t->n_part]);
+	}
+	return *p;
+      }
+
+      /* the partition holding x, LOCKED */
+      Partition& lock_partition(uint64_t x) {
+	Table* t = tab;
+	for (;;) {
+	  Partition& p = t->part[x % t->n_part];
+	  p.lock.lock();
+	  if (! p.moved) {
+	    return p;
+	  }
+	  p.lock.unlock();
+	  t = t->next;
+	}
+      }
+
+      /* the partition holding x, LOCKED, or nullptr if it is busy */
+      Partition* try_lock_partition(uint64_t x) {
+	Table* t = tab;
+	for (;;) {
+	  Partition& p = t->part[x % t->n_part];
+	  if (! p.lock.try_lock()) {
+	    return nullptr;
+	  }
+	  if (! p.moved) {
+	    return &p;
+	  }
+	  p.lock.unlock();
+	  t = t->next;
+	}
       }
 
       Partition& get(uint8_t x) {
-	return part[x];
+	return tab.load()->part[x];
       }
 
-      Partition*& get() {
-	return part;
+      Partition* get() {
+	return tab.load()->part;
       }
 
+      /* all partitions, excluding rehash until unlock */
       void lock() {
+	resize_mtx.lock();
 	std::for_each(locks.begin(), locks.end(),
 		      [](LK* lk){ lk->lock(); });
       }
@@ -331,38 +1326,70 @@ namespace cohort {
       void unlock() {
 	std::for_each(locks.begin(), locks.end(),
 		      [](LK* lk){ lk->unlock(); });
+	resize_mtx.unlock();
       }
 
       TreeX(int n_part=1, int csz=127) : n_part(n_part), csz(csz) {
 	//ceph_assert(n_part > 0);
-	part = new Partition[n_part];
+	tables.push_back(std::make_unique<Table>(n_part, csz));
+	tab = tables.back().get();
 	for (int ix = 0; ix < n_part; ++ix) {
-	  Partition& p = part[ix];
-	  if (csz) {
-	    p.csz = csz;
-	    p.cache = (T**) ::operator new(csz * sizeof(T*));
-	    // FIPS zeroization audit 20191115: this memset is not security related.
-	    memset(p.cache, 0, csz * sizeof(T*));
-	  }
-	  locks.push_back(&p.lock);
+	  locks.push_back(&(tab.load()->part[ix].lock));
 	}
       }
 
-      ~TreeX() {
-	delete[] part;
-      }
+      /* moves every element to a new table of n_part partitions, hashed
+       * by hash(const T&) as by the callers' hk, one partition at a time;
+       * lookups go on meanwhile, following moved partitions to the new
+       * table, so that each waits at most for the move of the one
+       * partition it hashes to */
+      template <typename H>
+      void rehash(int n_part, int csz, H hash) {
+	std::lock_guard guard{resize_mtx};
+	Table* old = tab;
+	if ((n_part < 1) || ((n_part == old->n_part) && (csz == this->csz))) {
+	  return;
+	}
+	tables.push_back(std::make_unique<Table>(n_part, csz));
+	Table* next = tables.back().get();
+	old->next = next;
+	for (int t_ix = 0; t_ix < old->n_part; ++t_ix) {
+	  Partition& p = old->part[t_ix];
+	  unique_lock p_lock{p.lock};
+	  while (p.tr.size() > 0) {
+	    iterator it = p.tr.begin();
+	    T* v = &(*it);
+	    p.tr.erase(it);
+	    Partition& np = next->part[hash(*v) % n_part];
+	    unique_lock np_lock{np.lock};
+	    np.tr.insert_unique(*v);
+	  }
+	  if (p.csz) {
+	    memset(p.cache, 0, p.csz * sizeof(T*));
+	  }
+	  p.moved = true;
+	}
+	locks.clear();
+	for (int ix = 0; ix < n_part; ++ix) {
+	  locks.push_back(&(next->part[ix].lock));
+	}
+	this->n_part = n_part;
+	this->csz = csz;
+	tab = next;
+      } /* rehash */
 
       T* find(uint64_t hk, const K& k, uint32_t flags) {
 	T* v;
 	Latch lat;
 	uint32_t slot = 0;
-	lat.p = &(partition_of_scalar(hk));
 	if (flags & FLAG_LOCK) {
+	  lat.p = &(lock_partition(hk));
 	  lat.lock = &lat.p->lock;
-	  lat.lock->lock();
+	} else {
+	  lat.p = &(partition_of_scalar(hk));
 	}
-	if (csz) { /* template specialize? */
-	  slot = hk % csz;
+	if (lat.p->csz) { /* template specialize? */
+	  slot = hk % lat.p->csz;
 	  v = lat.p->cache[slot];
 	  if (v) {
 	    if (CEQ()(*v, k)) {
@@ -378,7 +1405,7 @@ namespace cohort {
 	iterator it = lat.p->tr.find(k, CLT());
 	if (it != lat.p->tr.end()){
 	  v = &(*(it));
-	  if (csz) {
+	  if (lat.p->csz) {
 	    /* fill cache slot at hk */
 	    lat.p->cache[slot] = v;
 	  }
@@ -392,12 +1419,11 @@ namespace cohort {
 		    uint32_t flags) {
 	uint32_t slot = 0;
 	T* v;
-	lat.p = &(partition_of_scalar(hk));
+	lat.p = (flags & FLAG_LOCK) ? &(lock_partition(hk))
+	  : &(partition_of_scalar(hk));
 	lat.lock = &lat.p->lock;
-	if (flags & FLAG_LOCK)
-	  lat.lock->lock();
-	if (csz) { /* template specialize? */
-	  slot = hk % csz;
+	if (lat.p->csz) { /* template specialize? */
+	  slot = hk % lat.p->csz;
 	  v = lat.p->cache[slot];
 	  if (v) {
 	    if (CEQ()(*v, k)) {
@@ -414,7 +1440,7 @@ namespace cohort {
 	  k, CLT(), lat.commit_data);
 	if (! r.second /* !insertable (i.e., !found) */) {
 	  v = &(*(r.first));
-	  if (csz) {
+	  if (lat.p->csz) {
 	    /* fill cache slot at hk */
 	    lat.p->cache[slot] = v;
 	  }
@@ -433,22 +1459,20 @@ namespace cohort {
       } /* insert_latched */
 
       void insert(uint64_t hk, T* v, uint32_t flags) {
-	Partition& p = partition_of_scalar(hk);
-	if (flags & FLAG_LOCK)
-	  p.lock.lock();
+	Partition& p = (flags & FLAG_LOCK) ? lock_partition(hk)
+	  : partition_of_scalar(hk);
 	p.tr.insert_unique(*v);
 	if (flags & FLAG_LOCK)
 	  p.lock.unlock();
       } /* insert */
 
       void remove(uint64_t hk, T* v, uint32_t flags) {
-	Partition& p = partition_of_scalar(hk);
+	Partition& p = (flags & FLAG_LOCK) ? lock_partition(hk)
+	  : partition_of_scalar(hk);
 	iterator it = TTree::s_iterator_to(*v);
-	if (flags & FLAG_LOCK)
-	  p.lock.lock();
 	p.tr.erase(it);
-	if (csz) { /* template specialize? */
-	  uint32_t slot = hk % csz;
+	if (p.csz) { /* template specialize? */
+	  uint32_t slot = hk % p.csz;
 	  T* v2 = p.cache[slot];
 	  /* we are intrusive, just compare addresses */
 	  if (v == v2)
@@ -458,14 +1482,34 @@ namespace cohort {
 	  p.lock.unlock();
       } /* remove */
 
+      /* visit each element, in place (func runs under the partition
+       * lock if FLAG_LOCK) */
+      template <typename F>
+      void for_each(F func, uint32_t flags = FLAG_NONE) {
+	std::lock_guard guard{resize_mtx};
+	Table* t = tab;
+	for (int t_ix = 0; t_ix < t->n_part; ++t_ix) {
+	  Partition& p = t->part[t_ix];
+	  if (flags & FLAG_LOCK) /* LOCKED */
+	    p.lock.lock();
+	  for (auto& v : p.tr) {
+	    func(&v);
+	  }
+	  if (flags & FLAG_LOCK) /* we locked it, !LOCKED */
+	    p.lock.unlock();
+	} /* each partition */
+      } /* for_each */
+
       void drain(std::function<void(T*)> uref,
 		 uint32_t flags = FLAG_NONE) {
 	/* clear a table, call supplied function on
 	 * each element found (e.g., returns sentinel
 	 * references) */
 	Object::Queue2 drain_q;
-	for (int t_ix = 0; t_ix < n_part; ++t_ix) {
-	  Partition& p = part[t_ix];
+	std::unique_lock guard{resize_mtx};
+	Table* t = tab;
+	for (int t_ix = 0; t_ix < t->n_part; ++t_ix) {
+	  Partition& p = t->part[t_ix];
 	  if (flags & FLAG_LOCK) /* LOCKED */
 	    p.lock.lock();
 	  while (p.tr.size() > 0) {
@@ -477,6 +1521,7 @@ namespace cohort {
 	  if (flags & FLAG_LOCK) /* we locked it, !LOCKED */
 	    p.lock.unlock();
 	} /* each partition */
+	guard.unlock();
 	/* unref out-of-line && !LOCKED */
 	while (drain_q.size() > 0) {
 	  Object::Queue2::iterator it = drain_q.begin();
@@ -487,8 +1532,10 @@ namespace cohort {
       } /* drain */
 
     private:
-      Partition *part;
-      std::vector<LK*> locks;
+      std::atomic<Table*> tab;
+      std::mutex resize_mtx;
+      std::vector<std::unique_ptr<Table>> tables; /* resize_mtx */
+      std::vector<LK*> locks; /* resize_mtx */
     };
 
   } /* namespace LRU */
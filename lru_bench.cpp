@@ -0,0 +1,192 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab ft=cpp
+
+/* replays a Zipfian bucket workload, interleaved with a crawler that lists
+ * a run of cold buckets once each, against each cohort::lru policy, and
+ * reports hit rate, fills (misses), and the total and mean cost of the
+ * fills, where a bucket's fill costs its size, drawn independently of its
+ * popularity from a Pareto distribution (most buckets small, a few huge) */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <unordered_map>
+#include <vector>
+#include "cohort_lru.h"
+
+namespace {
+
+  namespace lru = cohort::lru;
+
+  /* any well-mixed function of the key */
+  uint64_t mix(uint64_t key) {
+    uint64_t h = key * 0x9e3779b97f4a7c15ULL;
+    return h ^ (h >> 32);
+  }
+
+  struct Sim;
+  using index_t = std::unordered_map<uint64_t, Sim*>;
+
+  /* stands in for a Bucket: indexed by key while cached */
+  struct Sim : public lru::Object
+  {
+    index_t* idx;
+    uint64_t key;
+
+    Sim(index_t* idx, uint64_t key) : idx(idx), key(key) {}
+
+    bool reclaim(const lru::ObjectFactory*) override {
+      idx->erase(key);
+      return true;
+    }
+
+    class Factory : public lru::ObjectFactory
+    {
+    public:
+      index_t* idx;
+      uint64_t key;
+
+      Factory(index_t* idx, uint64_t key) : idx(idx), key(key) {}
+
+      void recycle(lru::Object* o) override {
+	o->~Object();
+	new (o) Sim(idx, key);
+      }
+
+      lru::Object* alloc() override {
+	return new Sim(idx, key);
+      }
+
+      uint64_t hash() const override {
+	return mix(key);
+      }
+    }; /* Factory */
+  }; /* Sim */
+
+  struct Config
+  {
+    uint64_t ops{2000000};
+    uint64_t keys{20000}; /* Zipfian universe */
+    double theta{0.99};
+    uint32_t capacity{1000};
+    uint32_t lanes{4};
+    uint32_t scan_every{100000}; /* ops between crawls */
+    uint32_t scan_len{10000}; /* cold buckets per crawl */
+    uint64_t min_size{100}; /* entries */
+    uint64_t max_size{2000000};
+    double alpha{1.2}; /* Pareto shape */
+  };
+
+  /* entries in the bucket, and so the cost of its fill */
+  uint64_t size_of(const Config& cfg, uint64_t key) {
+    double u = double((mix(key ^ 0x5bd1e995) >> 11) + 1) / double(1ULL << 53);
+    double size = double(cfg.min_size) / std::pow(u, 1.0 / cfg.alpha);
+    return std::min(uint64_t(size), cfg.max_size);
+  }
+
+  struct Result
+  {
+    uint64_t hits{0};
+    uint64_t fills{0};
+    uint64_t fill_cost{0};
+    double secs{0};
+  };
+
+  Result run(const Config& cfg, lru::Policy policy,
+	     const std::vector<double>& cdf) {
+    lru::LRU<std::mutex> cache(cfg.lanes, cfg.capacity / cfg.lanes, policy);
+    index_t idx;
+    std::mt19937_64 rng(8675309);
+    std::uniform_real_distribution<double> u(0.0, 1.0);
+    uint64_t scan_base{cfg.keys};
+    uint32_t scan_pos{cfg.scan_len};
+    Result res;
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t op = 0; op < cfg.ops; ++op) {
+      if ((op % cfg.scan_every) == 0) {
+	scan_pos = 0;
+      }
+      uint64_t key;
+      if ((scan_pos < cfg.scan_len) && ((op & 1) == 0)) {
+	/* each crawl lists buckets never seen before */
+	key = scan_base++;
+	++scan_pos;
+      } else {
+	key = std::lower_bound(cdf.begin(), cdf.end(), u(rng)) - cdf.begin();
+      }
+      auto it = idx.find(key);
+      Sim* o;
+      if (it != idx.end()) {
+	o = it->second;
+	cache.ref(o, lru::FLAG_INITIAL);
+	++res.hits;
+      } else {
+	Sim::Factory fac(&idx, key);
+	uint32_t iflags{lru::FLAG_INITIAL};
+	o = static_cast<Sim*>(cache.insert(&fac, lru::Edge::MRU, iflags));
+	idx.emplace(key, o);
+	uint64_t cost = size_of(cfg, key);
+	cache.set_cost(o, cost);
+	++res.fills;
+	res.fill_cost += cost;
+      }
+      cache.unref(o, lru::FLAG_NONE);
+    }
+    res.secs = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+    /* drop the sentinel refs */
+    for (auto& [key, o] : idx) {
+      cache.unref(o, lru::FLAG_NONE);
+    }
+    return res;
+  } /* run */
+
+} /* namespace */
+
+int main(int argc, char* argv[])
+{
+  Config cfg;
+  if (argc > 1) {
+    cfg.ops = std::strtoull(argv[1], nullptr, 10);
+  }
+  if (argc > 2) {
+    cfg.capacity = std::strtoul(argv[2], nullptr, 10);
+  }
+
+  std::vector<double> cdf(cfg.keys);
+  double sum{0};
+  for (uint64_t ix = 0; ix < cfg.keys; ++ix) {
+    sum += 1.0 / std::pow(double(ix + 1), cfg.theta);
+    cdf[ix] = sum;
+  }
+  for (auto& p : cdf) {
+    p /= sum;
+  }
+
+  std::cout << "ops " << cfg.ops << " keys " << cfg.keys << " theta "
+	    << cfg.theta << " capacity " << cfg.capacity << " scan "
+	    << cfg.scan_len << "/" << cfg.scan_every << std::endl;
+
+  const std::pair<lru::Policy, const char*> policies[] = {
+    {lru::Policy::LRU, "lru"},
+    {lru::Policy::S3FIFO, "s3fifo"},
+    {lru::Policy::TINYLFU, "tinylfu"},
+    {lru::Policy::COST, "cost"},
+  };
+  for (const auto& [policy, name] : policies) {
+    auto res = run(cfg, policy, cdf);
+    std::cout << name << "\thit rate "
+	      << (100.0 * res.hits) / (res.hits + res.fills)
+	      << "%\tfills " << res.fills << "\tfill cost " << res.fill_cost
+	      << "\tper fill " << (res.fills ? res.fill_cost / res.fills : 0)
+	      << "\t" << res.secs << "s"
+	      << std::endl;
+  }
+  return 0;
+}
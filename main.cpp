@@ -8,6 +8,8 @@
 #include <string>
 #include <string_view>
 #include <random>
+#include <unordered_map>
+#include <mutex>
 #include <ranges>
 #include <thread>
 #include <stdint.h>
@@ -35,6 +37,105 @@ namespace {
   std::uniform_int_distribution<> dist_1m(1, 1000000);
   BucketCache* bc{nullptr};
   std::vector<std::string> bvec;
+  uint64_t inotify1_gen{0};
+  uint64_t inotify1_seq{0};
+
+  /* a bare cohort::lru object, indexed by key while cached, for policy
+   * tests without buckets */
+  struct LruObj : public cohort::lru::Object
+  {
+    using index_t = std::unordered_map<uint64_t, LruObj*>;
+
+    index_t* idx;
+    uint64_t key;
+
+    LruObj(index_t* idx, uint64_t key) : idx(idx), key(key) {}
+
+    bool reclaim(const cohort::lru::ObjectFactory*) override {
+      idx->erase(key);
+      return true;
+    }
+
+    class Factory : public cohort::lru::ObjectFactory
+    {
+    public:
+      index_t* idx;
+      uint64_t key;
+
+      Factory(index_t* idx, uint64_t key) : idx(idx), key(key) {}
+
+      void recycle(cohort::lru::Object* o) override {
+	o->~Object();
+	new (o) LruObj(idx, key);
+      }
+
+      cohort::lru::Object* alloc() override {
+	return new LruObj(idx, key);
+      }
+
+      uint64_t hash() const override {
+	return (key + 1) * 0x9e3779b97f4a7c15ULL;
+      }
+    }; /* Factory */
+  }; /* LruObj */
+
+  /* one lane of capacity objects under policy */
+  struct LruPolicy
+  {
+    cohort::lru::LRU<std::mutex> cache;
+    LruObj::index_t idx;
+
+    LruPolicy(cohort::lru::Policy policy, uint32_t capacity)
+      : cache(1, capacity, policy) {}
+
+    void access(uint64_t key) {
+      LruObj* o;
+      auto it = idx.find(key);
+      if (it != idx.end()) {
+	o = it->second;
+	cache.ref(o, cohort::lru::FLAG_INITIAL);
+      } else {
+	LruObj::Factory fac(&idx, key);
+	uint32_t iflags{cohort::lru::FLAG_INITIAL};
+	o = static_cast<LruObj*>(cache.insert(&fac, cohort::lru::Edge::MRU, iflags));
+	idx.emplace(key, o);
+      }
+      cache.unref(o, cohort::lru::FLAG_NONE);
+    }
+
+    bool cached(uint64_t key) const {
+      return idx.contains(key);
+    }
+
+    ~LruPolicy() {
+      /* drop the sentinel refs */
+      for (auto& [key, o] : idx) {
+	cache.unref(o, cohort::lru::FLAG_NONE);
+      }
+    }
+  }; /* LruPolicy */
+
+  /* what a notify backend delivers, by directory, for backend tests
+   * without a cache */
+  struct Recorder : public Notifiable
+  {
+    using entry_t = std::pair<EventType, std::string>;
+    std::mutex mtx;
+    std::unordered_map<std::string, std::vector<entry_t>> events;
+    int notify(const std::string& dname, void* opaque,
+	       const std::vector<Event>& evec) override {
+      std::lock_guard guard{mtx};
+      auto& v = events[dname];
+      for (const auto& ev : evec) {
+	v.emplace_back(ev.type, ev.name ? std::string(*ev.name) : "");
+      }
+      return 0;
+    }
+    std::vector<entry_t> of(const std::string& dname) {
+      std::lock_guard guard{mtx};
+      return events[dname];
+    }
+  }; /* Recorder */
 } // anonymous ns
 
 namespace sf = std::filesystem;
@@ -109,6 +210,33 @@ TEST(BucketCache, ListThreads) /* clocked at 21ms on lemon, and yes,
   }
 }
 
+TEST(BucketCache, ListThreadsCoalesce1)
+{
+  /* identical concurrent listings may share one scan, but every lister
+   * must still see the complete result */
+  auto nthreads = 15;
+  std::vector<std::thread> threads;
+  std::vector<uint64_t> counts(nthreads, 0);
+
+  for (int ix = 0; ix < nthreads; ++ix) {
+    threads.push_back(std::thread([&, ix]() {
+      bc->list_bucket(tdir1, bucket1_marker,
+		      [&, ix](const std::string_view& k) -> int {
+			counts[ix]++;
+			return 0;
+		      });
+    }));
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  for (auto& count : counts) {
+    ASSERT_EQ(count, 100000);
+  }
+  std::cout << fmt::format("{} of {} listings coalesced", bc->coalesce_count,
+			   nthreads) << std::endl;
+}
+
 TEST(BucketCache, SetupRecycle1)
 {
   int nbuckets = 5;
@@ -185,6 +313,464 @@ TEST(BucketCache, TearDownBucketCacheRecyclePartitions1)
   bc = nullptr;
 }
 
+TEST(BucketCache, InitBucketCacheHeadroom1)
+{
+  bc = new BucketCache{bucket_root, database_root, 3, 1, 1, 1};
+  bc->set_headroom(1, 2);
+}
+
+TEST(BucketCache, ListNHeadroom1)
+{
+  /* once the cache fills, idle buckets are reclaimed in the background,
+   * and misses take them ready-made */
+  for (int pass = 0; pass < 2; ++pass) {
+    for (auto& bucket : bvec) {
+      bc->list_bucket(bucket, bucket1_marker, func);
+    }
+  }
+  for (int ix = 0; (ix < 50) && (bc->lru.headroom() < 1); ++ix) {
+    std::this_thread::sleep_for(10ms);
+  }
+  ASSERT_GT(bc->prereclaim_count, 0);
+  ASSERT_GE(bc->lru.headroom(), 1);
+  ASSERT_LE(bc->lru.size(), 3);
+}
+
+TEST(BucketCache, TearDownBucketCacheHeadroom1)
+{
+  delete bc;
+  bc = nullptr;
+}
+
+TEST(BucketCache, InitBucketCacheReclaim1)
+{
+  bc = new BucketCache{bucket_root, database_root, 1, 1, 1, 1};
+}
+
+TEST(BucketCache, ListReclaim1)
+{
+  /* recycling tdir1 frees its pages, which its refill reuses */
+  bc->list_bucket(tdir1, bucket1_marker, func);
+  bc->list_bucket(bvec[0], bucket1_marker, func);
+  bc->lmdbs.reclaimer(0).drain();
+  ASSERT_GE(bc->lmdbs.reclaimer(0).dropped, 1);
+  ASSERT_GE(bc->lmdbs.reclaimer(0).deleted, 100000);
+  auto sp1 = bc->lmdbs.space(0);
+  ASSERT_GT(sp1.free_pages, 100);
+
+  bc->list_bucket(tdir1, bucket1_marker, func);
+  bc->list_bucket(bvec[0], bucket1_marker, func);
+  bc->lmdbs.reclaimer(0).drain();
+  auto sp2 = bc->lmdbs.space(0);
+  ASSERT_LT(sp2.used_pages, sp1.used_pages + (sp1.used_pages / 2));
+}
+
+TEST(BucketCache, TearDownBucketCacheReclaim1)
+{
+  delete bc;
+  bc = nullptr;
+}
+
+TEST(BucketCache, InitBucketCacheOverflow1)
+{
+  bc = new BucketCache{bucket_root, database_root, 1, 1, 1, 1};
+}
+
+TEST(BucketCache, ListOverflow1)
+{
+  using Overflow = cohort::lru::Overflow;
+
+  /* a bucket held, so nothing is reclaimable */
+  auto [b0, f0] = bc->get_bucket(bvec[0], BucketCache::FLAG_NONE);
+  ASSERT_NE(b0, nullptr);
+
+  bc->lru.set_overflow(Overflow::FAIL, 0, 0ms);
+  auto [flags, gen] = bc->list_bucket(bvec[1], bucket1_marker, func);
+  ASSERT_TRUE(flags & BucketCache::FLAG_FULL);
+  ASSERT_EQ(bc->lru.counts().fails, 1);
+
+  /* until it is released */
+  bc->lru.set_overflow(Overflow::WAIT, 0, 5000ms);
+  std::thread thrd([b0]() {
+    std::this_thread::sleep_for(50ms);
+    bc->lru.unref(b0, cohort::lru::FLAG_NONE);
+  });
+  std::tie(flags, gen) = bc->list_bucket(bvec[1], bucket1_marker, func);
+  thrd.join();
+  ASSERT_FALSE(flags & BucketCache::FLAG_FULL);
+  ASSERT_EQ(bc->lru.counts().waits, 1);
+  ASSERT_EQ(bc->lru.counts().objects, 1);
+
+  /* or past capacity, as far as allowed */
+  auto [b1, f1] = bc->get_bucket(bvec[1], BucketCache::FLAG_NONE);
+  bc->lru.set_overflow(Overflow::OVERSHOOT, 1, 0ms);
+  std::tie(flags, gen) = bc->list_bucket(bvec[2], bucket1_marker, func);
+  ASSERT_FALSE(flags & BucketCache::FLAG_FULL);
+  auto c = bc->lru.counts();
+  ASSERT_EQ(c.overshoots, 1);
+  ASSERT_EQ(c.overshoot, 1);
+  ASSERT_EQ(c.overshoot_max, 1);
+  bc->lru.unref(b1, cohort::lru::FLAG_NONE);
+}
+
+TEST(BucketCache, TearDownBucketCacheOverflow1)
+{
+  delete bc;
+  bc = nullptr;
+}
+
+TEST(BucketCache, InitBucketCacheWeight1)
+{
+  bc = new BucketCache{bucket_root, database_root};
+  /* bvec buckets hold 10 objects each */
+  bc->set_budget(25, 0);
+}
+
+TEST(BucketCache, ListWeight1)
+{
+  auto trimmed = []() {
+    for (int ix = 0; (ix < 100) && bc->lru.over_budget(); ++ix) {
+      std::this_thread::sleep_for(10ms);
+    }
+    return ! bc->lru.over_budget();
+  };
+
+  for (auto& bucket : bvec) {
+    bc->list_bucket(bucket, bucket1_marker, func);
+  }
+  ASSERT_TRUE(trimmed());
+  ASSERT_LE(bc->lru.weight(BucketCache::WEIGHT_ENTRIES), 25);
+  ASSERT_GT(bc->lru.weight(BucketCache::WEIGHT_BYTES), 0);
+
+  /* and at run time */
+  bc->set_budget(0, 0);
+  for (auto& bucket : bvec) {
+    bc->list_bucket(bucket, bucket1_marker, func);
+  }
+  ASSERT_EQ(bc->lru.weight(BucketCache::WEIGHT_ENTRIES), 50);
+
+  bc->set_budget(10, 0);
+  ASSERT_TRUE(trimmed());
+  ASSERT_LE(bc->lru.weight(BucketCache::WEIGHT_ENTRIES), 10);
+}
+
+TEST(BucketCache, TearDownBucketCacheWeight1)
+{
+  delete bc;
+  bc = nullptr;
+}
+
+TEST(BucketCache, InitBucketCacheCost1)
+{
+  bc = new BucketCache{bucket_root, database_root, 2, 1, 1, 1, NotifyConfig(),
+		       cohort::lru::Policy::COST};
+}
+
+TEST(BucketCache, ListCost1)
+{
+  /* the 100K-object bucket outlasts the cheap ones listed after it */
+  bc->list_bucket(tdir1, bucket1_marker, func);
+  for (auto& bucket : bvec) {
+    bc->list_bucket(bucket, bucket1_marker, func);
+  }
+  ASSERT_EQ(bc->fill_count, 1 + bvec.size());
+  ASSERT_GT(bc->fill_us, 0);
+  ASSERT_NE(bc->get_generation(tdir1), 0);
+  ASSERT_NE(bc->get_generation(bvec.back()), 0);
+}
+
+TEST(BucketCache, TearDownBucketCacheCost1)
+{
+  delete bc;
+  bc = nullptr;
+}
+
+TEST(CohortLRU, S3FIFO1)
+{
+  /* two objects reused while on probation, then a crawl of 200 objects
+   * seen once: S3FIFO keeps the reused pair, LRU flushes them */
+  const auto run = [](cohort::lru::Policy policy) {
+    LruPolicy lp(policy, 20);
+    for (int pass = 0; pass < 3; ++pass) {
+      lp.access(0);
+      lp.access(1);
+    }
+    for (uint64_t key = 100; key < 300; ++key) {
+      lp.access(key);
+    }
+    EXPECT_EQ(lp.idx.size(), 20);
+    return lp.cached(0) && lp.cached(1);
+  };
+  ASSERT_TRUE(run(cohort::lru::Policy::S3FIFO));
+  ASSERT_FALSE(run(cohort::lru::Policy::LRU));
+} /* S3FIFO1 */
+
+TEST(CohortLRU, TinyLFU1)
+{
+  /* 18 objects used four times each fill the main queue; none of the
+   * crawl's once-seen objects outweighs them */
+  const auto run = [](cohort::lru::Policy policy) {
+    LruPolicy lp(policy, 20);
+    for (int pass = 0; pass < 4; ++pass) {
+      for (uint64_t key = 0; key < 18; ++key) {
+	lp.access(key);
+      }
+    }
+    for (uint64_t key = 100; key < 300; ++key) {
+      lp.access(key);
+    }
+    EXPECT_EQ(lp.idx.size(), 20);
+    uint32_t hot{0};
+    for (uint64_t key = 0; key < 18; ++key) {
+      hot += lp.cached(key);
+    }
+    return hot;
+  };
+  ASSERT_EQ(run(cohort::lru::Policy::TINYLFU), 18);
+  ASSERT_EQ(run(cohort::lru::Policy::LRU), 0);
+} /* TinyLFU1 */
+
+TEST(CohortLRU, Retire1)
+{
+  /* an object its owner has dropped goes straight to the free pool if
+   * idle, and is the next recycled; if busy, to the cold end, and is the
+   * next evicted once idle */
+  LruPolicy lp(cohort::lru::Policy::LRU, 4);
+  for (uint64_t key = 0; key < 4; ++key) {
+    lp.access(key);
+  }
+  const auto retire = [&lp](uint64_t key) {
+    LruObj* o = lp.idx[key];
+    lp.idx.erase(key);
+    lp.cache.ref(o, cohort::lru::FLAG_NONE);
+    return lp.cache.retire(o);
+  };
+  LruObj* o2 = lp.idx[2];
+  uint32_t room = lp.cache.headroom();
+  ASSERT_TRUE(retire(2));
+  ASSERT_EQ(lp.cache.headroom(), room + 1);
+  lp.access(10);
+  ASSERT_EQ(lp.idx[10], o2);
+  ASSERT_EQ(lp.cache.headroom(), room);
+
+  /* 10 is the hottest, and held elsewhere while retired */
+  lp.cache.ref(o2, cohort::lru::FLAG_NONE);
+  ASSERT_FALSE(retire(10));
+  lp.cache.unref(o2, cohort::lru::FLAG_NONE);
+  lp.access(20);
+  ASSERT_EQ(lp.idx[20], o2);
+  ASSERT_TRUE(lp.cached(0) && lp.cached(1) && lp.cached(3));
+} /* Retire1 */
+
+TEST(BucketCache, InitBucketCacheMissCurve1)
+{
+  bc = new BucketCache{bucket_root, database_root, 2, 1, 1, 1};
+  bc->lru.track_misses(8);
+}
+
+TEST(BucketCache, ListMissCurve1)
+{
+  /* cycling over more buckets than fit, a larger cache would hit */
+  for (int pass = 0; pass < 4; ++pass) {
+    for (auto& bucket : bvec) {
+      bc->list_bucket(bucket, bucket1_marker, func);
+    }
+  }
+  auto curve = bc->lru.miss_curve();
+  ASSERT_EQ(curve.front().size, 2);
+  ASSERT_GE(curve.back().size, 2 + bvec.size());
+  ASSERT_GT(curve.front().miss_ratio, 0);
+  ASSERT_LT(curve.back().miss_ratio, curve.front().miss_ratio);
+}
+
+TEST(BucketCache, AutoSizeMissCurve1)
+{
+  /* and grows to fit them */
+  BucketCache::AutoSize as;
+  as.min = 2;
+  as.max = 8;
+  as.interval = 50ms;
+  as.samples = 10;
+  bc->set_autosize(as);
+  for (int ix = 0; (ix < 200) && (bc->lru.capacity() < bvec.size()); ++ix) {
+    for (auto& bucket : bvec) {
+      bc->list_bucket(bucket, bucket1_marker, func);
+    }
+    std::this_thread::sleep_for(10ms);
+  }
+  ASSERT_GE(bc->lru.capacity(), bvec.size());
+  ASSERT_LE(bc->lru.capacity(), 8);
+  ASSERT_GT(bc->resize_count, 0);
+}
+
+TEST(BucketCache, TearDownBucketCacheMissCurve1)
+{
+  delete bc;
+  bc = nullptr;
+}
+
+TEST(BucketCache, InitBucketCacheReshape1)
+{
+  bc = new BucketCache{bucket_root, database_root, 4, 2, 2, 1};
+  for (auto& bucket : bvec) {
+    bc->list_bucket(bucket, bucket1_marker, func);
+  }
+}
+
+TEST(BucketCache, ReshapeReshape1)
+{
+  /* under load */
+  std::atomic<bool> stop{false};
+  std::thread lister([&stop]() {
+    while (! stop) {
+      for (auto& bucket : bvec) {
+	bc->list_bucket(bucket, bucket1_marker, func);
+      }
+    }
+  });
+  BucketCache::Shape sh;
+  sh.max_buckets = 8;
+  sh.lanes = 4;
+  sh.partitions = 5;
+  sh.lmdb_count = 3;
+  bc->reshape(sh);
+  std::this_thread::sleep_for(50ms);
+  stop = true;
+  lister.join();
+
+  auto sh2 = bc->get_shape();
+  ASSERT_EQ(sh2.max_buckets, 8);
+  ASSERT_EQ(sh2.lanes, 4);
+  ASSERT_EQ(sh2.partitions, 5);
+  ASSERT_EQ(sh2.lmdb_count, 3);
+  ASSERT_EQ(bc->lru.capacity(), 8);
+  ASSERT_EQ(bc->lmdbs.opened(), 3);
+
+  /* everything still found, and cached */
+  uint64_t recycled = bc->recycle_count;
+  for (auto& bucket : bvec) {
+    ASSERT_NE(bc->get_generation(bucket), 0);
+  }
+  ASSERT_EQ(bc->recycle_count, recycled);
+}
+
+TEST(BucketCache, ShrinkReshape1)
+{
+  BucketCache::Shape sh;
+  sh.max_buckets = 2;
+  sh.lanes = 1;
+  sh.partitions = 1;
+  sh.lmdb_count = 1;
+  bc->reshape(sh);
+  for (int ix = 0; (ix < 50) && bc->lru.over_capacity(); ++ix) {
+    std::this_thread::sleep_for(10ms);
+  }
+  ASSERT_FALSE(bc->lru.over_capacity());
+  ASSERT_EQ(bc->lru.capacity(), 2);
+  /* envs in use stay open */
+  ASSERT_EQ(bc->lmdbs.count(), 1);
+  ASSERT_EQ(bc->lmdbs.opened(), 3);
+  /* and what is left is still found */
+  int cached{0};
+  for (auto& bucket : bvec) {
+    if (bc->get_generation(bucket) != 0) {
+      ++cached;
+    }
+  }
+  ASSERT_GT(cached, 0);
+  ASSERT_LE(cached, 2);
+}
+
+TEST(BucketCache, TearDownBucketCacheReshape1)
+{
+  delete bc;
+  bc = nullptr;
+}
+
+TEST(BucketCache, InitBucketCachePin1)
+{
+  PinConfig pcfg;
+  pcfg.budget = 1;
+  pcfg.buckets.push_back(bvec[0]);
+  bc = new BucketCache{bucket_root, database_root, 2, 1, 1, 1, NotifyConfig(),
+		       cohort::lru::Policy::LRU, pcfg};
+  ASSERT_EQ(bc->lru.counts().pinned, 1);
+}
+
+TEST(BucketCache, ListPin1)
+{
+  /* cycling through more buckets than fit never refills a pinned one */
+  uint64_t gen = bc->get_generation(bvec[0]);
+  ASSERT_NE(gen, 0);
+  for (int pass = 0; pass < 3; ++pass) {
+    for (auto& bucket : bvec) {
+      bc->list_bucket(bucket, bucket1_marker, func);
+    }
+  }
+  ASSERT_GT(bc->recycle_count, 0);
+  ASSERT_EQ(bc->get_generation(bvec[0]), gen);
+}
+
+TEST(BucketCache, BudgetPin1)
+{
+  ASSERT_EQ(bc->pin_bucket(bvec[1]), -ENOSPC);
+  ASSERT_EQ(bc->unpin_bucket(bvec[0]), 0);
+  ASSERT_EQ(bc->lru.counts().pinned, 0);
+  ASSERT_EQ(bc->pin_bucket(bvec[1]), 0);
+  ASSERT_EQ(bc->lru.counts().pinned, 1);
+  ASSERT_EQ(bc->pin_bucket("no_such_bucket"), -ENOENT);
+}
+
+TEST(BucketCache, TearDownBucketCachePin1)
+{
+  delete bc;
+  bc = nullptr;
+}
+
+TEST(BucketCache, InitBucketCacheIdle1)
+{
+  bc = new BucketCache{bucket_root, database_root};
+  bc->set_pin_budget(1);
+  for (auto& bucket : bvec) {
+    bc->list_bucket(bucket, bucket1_marker, func);
+  }
+  ASSERT_EQ(bc->pin_bucket(bvec[2]), 0);
+  bc->set_idle_ttl(200ms);
+}
+
+TEST(BucketCache, ExpireIdle1)
+{
+  /* bvec[1] stays in use, bvec[2] is pinned, the rest go idle */
+  uint32_t room = bc->lru.headroom();
+  for (int ix = 0; ix < 12; ++ix) {
+    bc->list_bucket(bvec[1], bucket1_marker, func);
+    std::this_thread::sleep_for(50ms);
+  }
+  ASSERT_EQ(bc->get_generation(bvec[0]), 0);
+  ASSERT_NE(bc->get_generation(bvec[1]), 0);
+  ASSERT_NE(bc->get_generation(bvec[2]), 0);
+  ASSERT_EQ(bc->expire_count, bvec.size() - 2);
+  /* their objects are free at once, not left to age out */
+  ASSERT_EQ(bc->lru.headroom(), room + bvec.size() - 2);
+  /* and come back on demand */
+  bc->list_bucket(bvec[0], bucket1_marker, func);
+  ASSERT_NE(bc->get_generation(bvec[0]), 0);
+  ASSERT_EQ(bc->lru.headroom(), room + bvec.size() - 3);
+}
+
+TEST(BucketCache, DisableIdle1)
+{
+  bc->set_idle_ttl(0ms);
+  std::this_thread::sleep_for(400ms);
+  ASSERT_NE(bc->get_generation(bvec[0]), 0);
+}
+
+TEST(BucketCache, TearDownBucketCacheIdle1)
+{
+  delete bc;
+  bc = nullptr;
+}
+
 TEST(BucketCache, SetupMarker1)
 {
   int nfiles = 20;
@@ -268,10 +854,64 @@ TEST(BucketCache, ListInotify1)
     return 0;
   };
 
-  bc->list_bucket(bucket, marker, f);
+  auto [flags, gen] = bc->list_bucket(bucket, marker, f);
   ASSERT_EQ(names.size(), 20);
+  ASSERT_FALSE(flags & BucketCache::FLAG_UNCHANGED);
+  ASSERT_EQ(gen, bc->get_generation(bucket));
+  inotify1_gen = gen;
 } /* ListInotify1 */
 
+TEST(BucketCache, ListUnchangedInotify1)
+{
+  std::string bucket{"inotify1"};
+  std::string marker{""};
+  std::vector<std::string> names;
+
+  auto f = [&](const std::string_view& k) -> int {
+    names.push_back(std::string{k});
+    return 0;
+  };
+
+  /* nothing changed, so a conditional listing answers without listing */
+  auto [flags, gen] = bc->list_bucket(bucket, marker, f, inotify1_gen);
+  ASSERT_TRUE(flags & BucketCache::FLAG_UNCHANGED);
+  ASSERT_EQ(gen, inotify1_gen);
+  ASSERT_EQ(names.size(), 0);
+} /* ListUnchangedInotify1 */
+
+TEST(BucketCache, ChangesInotify1)
+{
+  std::string bucket{"inotify1"};
+  uint64_t nchanges{0};
+
+  auto f = [&](Notifiable::EventType type, const std::string_view& k) -> int {
+    nchanges++;
+    return 0;
+  };
+
+  /* no sequence was issued yet, so a listing is the baseline */
+  auto [flags0, seq0] = bc->changes_since(bucket, inotify1_seq, f);
+  ASSERT_TRUE(flags0 & BucketCache::FLAG_RELIST);
+  ASSERT_EQ(nchanges, 0);
+
+  /* just listed, so there is nothing to catch up on */
+  auto [flags, seq] = bc->changes_since(bucket, seq0, f);
+  ASSERT_FALSE(flags & BucketCache::FLAG_RELIST);
+  ASSERT_EQ(nchanges, 0);
+  ASSERT_EQ(seq, seq0);
+
+  /* nor from a sequence never issued */
+  auto [flags1, seq1] = bc->changes_since(bucket, seq0 + 1000, f);
+  ASSERT_TRUE(flags1 & BucketCache::FLAG_RELIST);
+  inotify1_seq = seq;
+
+  /* a bucket not cached is relisted, not filled to be told so */
+  auto [flags2, seq2] = bc->changes_since(bvec[0], seq0, f);
+  ASSERT_TRUE(flags2 & BucketCache::FLAG_RELIST);
+  ASSERT_EQ(seq2, 0);
+  ASSERT_EQ(bc->get_generation(bvec[0]), 0);
+} /* ChangesInotify1 */
+
 TEST(BucketCache, UpdateInotify1)
 {
   int nfiles = 10;
@@ -295,10 +935,11 @@ TEST(BucketCache, UpdateInotify1)
     sf::remove(ttp);
   }
 
-  /* this step is async, temporally consistent */
-  std::cout << "waiting 50ms for cache sync" << std::endl;
-  std::this_thread::sleep_for(50ms);
-} /* SetupInotify1 */
+  /* this step is async, temporally consistent--fence rather than
+   * guessing how long the cache takes to sync */
+  auto rc = bc->fence(bucket, std::chrono::steady_clock::now() + 5s);
+  ASSERT_EQ(rc, 0);
+} /* UpdateInotify1 */
 
 TEST(BucketCache, List2Inotify1)
 {
@@ -312,8 +953,10 @@ TEST(BucketCache, List2Inotify1)
     return 0;
   };
 
-  bc->list_bucket(bucket, marker, f);
+  auto [flags, gen] = bc->list_bucket(bucket, marker, f, inotify1_gen);
   ASSERT_EQ(names.size(), 25);
+  ASSERT_FALSE(flags & BucketCache::FLAG_UNCHANGED);
+  ASSERT_GT(gen, inotify1_gen);
 
   /* check these */
   sf::path tp{sf::path{bucket_root} / bucket};
@@ -332,12 +975,584 @@ TEST(BucketCache, List2Inotify1)
   }
 } /* List2Inotify1 */
 
+TEST(BucketCache, Changes2Inotify1)
+{
+  std::string bucket{"inotify1"};
+  uint64_t nadd{0}, nremove{0};
+
+  auto f = [&](Notifiable::EventType type, const std::string_view& k) -> int {
+    switch (type) {
+    case Notifiable::EventType::ADD:
+      nadd++;
+      break;
+    case Notifiable::EventType::REMOVE:
+      nremove++;
+      break;
+    default:
+      break;
+    }
+    return 0;
+  };
+
+  /* the deltas replay exactly the updates made in UpdateInotify1 */
+  auto [flags, seq] = bc->changes_since(bucket, inotify1_seq, f);
+  ASSERT_FALSE(flags & BucketCache::FLAG_RELIST);
+  ASSERT_EQ(nadd, 10);
+  ASSERT_EQ(nremove, 5);
+  ASSERT_GT(seq, inotify1_seq);
+  inotify1_seq = seq;
+} /* Changes2Inotify1 */
+
+TEST(BucketCache, WriteThroughInotify1)
+{
+  std::string bucket{"inotify1"};
+  std::string marker{""};
+  std::string oname{"wtfile_0"};
+  std::vector<std::string> names;
+  uint64_t nchanges{0};
+
+  auto f = [&](const std::string_view& k) -> int {
+    names.push_back(std::string{k});
+    return 0;
+  };
+
+  auto fc = [&](Notifiable::EventType type, const std::string_view& k) -> int {
+    nchanges++;
+    return 0;
+  };
+
+  /* nothing cached to write through to */
+  ASSERT_EQ(bc->put_object(bvec[0], oname), -ENOENT);
+  ASSERT_EQ(bc->get_generation(bvec[0]), 0);
+
+  /* write through before creating, so the echo can only follow it */
+  ASSERT_EQ(bc->put_object(bucket, oname), 0);
+  bc->list_bucket(bucket, marker, f);
+  ASSERT_EQ(names.size(), 26);
+  uint64_t gen = bc->get_generation(bucket);
+
+  sf::path ttp{sf::path{bucket_root} / bucket / oname};
+  std::ofstream ofs(ttp);
+  ofs << "data for " << ttp << std::endl;
+  ofs.close();
+
+  /* the echo is a no-op, so the change is logged once, and the
+   * generation stands */
+  ASSERT_EQ(bc->fence(bucket, std::chrono::steady_clock::now() + 5s), 0);
+  ASSERT_EQ(bc->get_generation(bucket), gen);
+  auto [flags, seq] = bc->changes_since(bucket, inotify1_seq, fc);
+  ASSERT_FALSE(flags & BucketCache::FLAG_RELIST);
+  ASSERT_EQ(nchanges, 1);
+
+  ASSERT_EQ(bc->delete_object(bucket, oname), 0);
+  sf::remove(ttp);
+  names.clear();
+  bc->list_bucket(bucket, marker, f);
+  ASSERT_EQ(names.size(), 25);
+} /* WriteThroughInotify1 */
+
+TEST(BucketCache, RemoveBucketInotify1)
+{
+  std::string bucket{"inotify1_rm"};
+  std::string marker{""};
+  std::vector<std::string> names;
+
+  auto f = [&](const std::string_view& k) -> int {
+    names.push_back(std::string{k});
+    return 0;
+  };
+
+  sf::path tp{sf::path{bucket_root} / bucket};
+  sf::remove_all(tp);
+  sf::create_directory(tp);
+  std::ofstream ofs(tp / "file_0");
+  ofs.close();
+
+  auto [flags, gen] = bc->list_bucket(bucket, marker, f);
+  ASSERT_EQ(flags, BucketCache::FLAG_NONE);
+  ASSERT_EQ(names.size(), 1);
+
+  /* removing the directory evicts the cached bucket, and its object is
+   * free for the next bucket at once */
+  uint64_t nevict = bc->evict_count;
+  uint32_t room = bc->lru.headroom();
+  sf::remove_all(tp);
+  ASSERT_EQ(bc->fence("", std::chrono::steady_clock::now() + 5s), 0);
+  ASSERT_EQ(bc->evict_count, nevict + 1);
+  ASSERT_EQ(bc->lru.headroom(), room + 1);
+
+  names.clear();
+  auto [flags2, gen2] = bc->list_bucket(bucket, marker, f);
+  ASSERT_EQ(flags2, BucketCache::FLAG_NOENT);
+  ASSERT_EQ(names.size(), 0);
+} /* RemoveBucketInotify1 */
+
 TEST(BucketCache, TearDownInotify1)
 {
   delete bc;
   bc = nullptr;
 }
 
+TEST(BucketCache, InitBucketCacheShard1)
+{
+  NotifyConfig ncfg;
+  ncfg.backend = NotifyConfig::Backend::INOTIFY;
+  ncfg.inotify_shards = 3;
+  bc = new BucketCache{bucket_root, database_root, 100, 3, 3, 3, ncfg};
+}
+
+TEST(BucketCache, ListShard1)
+{
+  std::string marker{""};
+
+  /* buckets spread over the shards, each change delivered by its own */
+  for (auto& bucket : bvec) {
+    uint64_t nnames{0};
+    bc->list_bucket(bucket, marker, [&](const std::string_view& k) -> int {
+      nnames++;
+      return 0;
+    });
+    ASSERT_EQ(nnames, 10);
+  }
+  ASSERT_EQ(bc->un->counts().watched, bvec.size());
+
+  for (auto& bucket : bvec) {
+    std::ofstream ofs(sf::path{bucket_root} / bucket / "shard_new");
+    ofs.close();
+  }
+  for (auto& bucket : bvec) {
+    ASSERT_EQ(bc->fence(bucket, std::chrono::steady_clock::now() + 5s), 0);
+    uint64_t nnames{0};
+    bool found{false};
+    bc->list_bucket(bucket, marker, [&](const std::string_view& k) -> int {
+      nnames++;
+      found = found || (k == "shard_new");
+      return 0;
+    });
+    ASSERT_EQ(nnames, 11);
+    ASSERT_TRUE(found);
+  }
+} /* ListShard1 */
+
+TEST(BucketCache, ChurnShard1)
+{
+  /* watches are dropped and re-added while their shards deliver events,
+   * so registry records are retired under readers (QSBR) */
+  std::string marker{""};
+  std::atomic<bool> done{false};
+
+  std::thread writer([&]() {
+    for (int ix = 0; ix < 200; ++ix) {
+      for (int bx = 0; bx < 3; ++bx) {
+	sf::path tp{sf::path{bucket_root} / bvec[bx] / fmt::format("churn_{}", ix % 10)};
+	if (ix < 100) {
+	  std::ofstream ofs(tp);
+	  ofs.close();
+	} else {
+	  sf::remove(tp);
+	}
+      }
+    }
+    done = true;
+  });
+  std::vector<std::thread> churners;
+  for (int bx = 0; bx < 3; ++bx) {
+    churners.push_back(std::thread([&, bx]() {
+      while (! done) {
+	(void) bc->evict_bucket(bvec[bx]);
+	bc->list_bucket(bvec[bx], marker, [](const std::string_view& k) -> int {
+	  return 0;
+	});
+      }
+    }));
+  }
+  writer.join();
+  for (auto& t : churners) {
+    t.join();
+  }
+
+  /* whichever incarnation took the last events, the cache agrees with
+   * the directory */
+  for (int bx = 0; bx < 3; ++bx) {
+    ASSERT_EQ(bc->fence(bvec[bx], std::chrono::steady_clock::now() + 5s), 0);
+    uint64_t nnames{0};
+    bc->list_bucket(bvec[bx], marker, [&](const std::string_view& k) -> int {
+      nnames++;
+      return 0;
+    });
+    ASSERT_EQ(nnames, 11);
+  }
+  ASSERT_EQ(bc->un->counts().watched, bvec.size());
+} /* ChurnShard1 */
+
+TEST(BucketCache, StaleHandleShard1)
+{
+  std::string bucket{bvec[0]};
+  std::string marker{""};
+  std::vector<Notifiable::Event> evec;
+  const auto listed = [&](const std::string_view& name) {
+    bool found{false};
+    bc->list_bucket(bucket, marker, [&](const std::string_view& k) -> int {
+      found = found || (k == name);
+      return 0;
+    });
+    return found;
+  };
+
+  auto [b, flags] = bc->get_bucket(bucket, BucketCache::FLAG_NONE);
+  ASSERT_NE(b, nullptr);
+  void* stale = b->handle;
+  bc->lru.unref(b, cohort::lru::FLAG_NONE);
+
+  /* evicted and watched again: the old incarnation's handle is refused */
+  ASSERT_TRUE(bc->evict_bucket(bucket));
+  ASSERT_FALSE(listed("ghost"));
+  evec.emplace_back(Notifiable::Event(Notifiable::EventType::ADD, "ghost"));
+  (void) bc->notify(bucket, stale, evec);
+  ASSERT_FALSE(listed("ghost"));
+
+  /* and the new one's watch delivers */
+  std::ofstream ofs(sf::path{bucket_root} / bucket / "rewatched");
+  ofs.close();
+  ASSERT_EQ(bc->fence(bucket, std::chrono::steady_clock::now() + 5s), 0);
+  ASSERT_TRUE(listed("rewatched"));
+
+  sf::remove(sf::path{bucket_root} / bucket / "rewatched");
+  for (auto& bname : bvec) {
+    sf::remove(sf::path{bucket_root} / bname / "shard_new");
+  }
+} /* StaleHandleShard1 */
+
+TEST(BucketCache, TearDownShard1)
+{
+  delete bc;
+  bc = nullptr;
+}
+
+TEST(BucketCache, InitBucketCacheBudget1)
+{
+  NotifyConfig ncfg;
+  ncfg.backend = NotifyConfig::Backend::INOTIFY;
+  ncfg.watch_budget = 1;
+  bc = new BucketCache{bucket_root, database_root, 100, 3, 3, 3, ncfg};
+}
+
+TEST(BucketCache, ListBudget1)
+{
+  std::string marker{""};
+
+  /* one bucket gets the only inotify watch, the other is polled */
+  for (int ix = 0; ix < 2; ++ix) {
+    std::vector<std::string> names;
+    bc->list_bucket(bvec[ix], marker,
+		    [&](const std::string_view& k) -> int {
+		      names.push_back(std::string{k});
+		      return 0;
+		    });
+    ASSERT_EQ(names.size(), 10);
+  }
+  auto counts = bc->un->counts();
+  ASSERT_EQ(counts.watched, 1);
+  ASSERT_EQ(counts.polled, 1);
+} /* ListBudget1 */
+
+TEST(BucketCache, UpdateBudget1)
+{
+  std::string marker{""};
+
+  /* whichever tier a bucket is in, a fence catches it up */
+  for (int ix = 0; ix < 2; ++ix) {
+    sf::path ttp{sf::path{bucket_root} / bvec[ix] / "upfile_0"};
+    std::ofstream ofs(ttp);
+    ofs << "data for " << ttp << std::endl;
+    ofs.close();
+  }
+  for (int ix = 0; ix < 2; ++ix) {
+    std::vector<std::string> names;
+    ASSERT_EQ(bc->fence(bvec[ix], std::chrono::steady_clock::now() + 5s), 0);
+    bc->list_bucket(bvec[ix], marker,
+		    [&](const std::string_view& k) -> int {
+		      names.push_back(std::string{k});
+		      return 0;
+		    });
+    ASSERT_EQ(names.size(), 11);
+  }
+} /* UpdateBudget1 */
+
+TEST(BucketCache, TearDownBudget1)
+{
+  delete bc;
+  bc = nullptr;
+}
+
+TEST(BucketCache, SetupRecursive1)
+{
+  /* recursive1/{top_N, d_M/file_N, d_M/sub/file_N} */
+  sf::path tp{sf::path{bucket_root} / "recursive1"};
+  sf::remove_all(tp);
+  sf::remove_all(sf::path{bucket_root} / "staging1");
+  sf::create_directories(sf::path{bucket_root} / "staging1");
+  for (int dx = 0; dx < 3; ++dx) {
+    sf::path dp{tp / fmt::format("d_{}", dx) / "sub"};
+    sf::create_directories(dp);
+    for (int ix = 0; ix < 5; ++ix) {
+      std::ofstream ofs(dp.parent_path() / fmt::format("file_{}", ix));
+      std::ofstream ofs2(dp / fmt::format("file_{}", ix));
+    }
+  }
+  for (int ix = 0; ix < 4; ++ix) {
+    std::ofstream ofs(tp / fmt::format("top_{}", ix));
+  }
+} /* SetupRecursive1 */
+
+TEST(BucketCache, InitBucketCacheRecursive1)
+{
+  NotifyConfig ncfg;
+  ncfg.backend = NotifyConfig::Backend::INOTIFY;
+  ncfg.recursive = true;
+  bc = new BucketCache{bucket_root, database_root, 100, 3, 3, 3, ncfg};
+  /* walk the subdirectories in parallel */
+  bc->fill_threads = 4;
+}
+
+TEST(BucketCache, ListRecursive1)
+{
+  std::string bucket{"recursive1"};
+  std::string marker{""};
+  std::vector<std::string> names;
+
+  bc->list_bucket(bucket, marker,
+		  [&](const std::string_view& k) -> int {
+		    names.push_back(std::string{k});
+		    return 0;
+		  });
+  ASSERT_EQ(names.size(), 34);
+  ASSERT_TRUE(std::find(names.begin(), names.end(), "d_1/sub/file_3") != names.end());
+} /* ListRecursive1 */
+
+TEST(BucketCache, ListDelimitedRecursive1)
+{
+  std::string bucket{"recursive1"};
+  std::vector<std::string> keys, prefixes;
+
+  auto f = [&](const std::string_view& k, bool cp) -> int {
+    (cp ? prefixes : keys).push_back(std::string{k});
+    return 0;
+  };
+
+  bc->list_bucket_delimited(bucket, "", "/", "", f);
+  ASSERT_EQ(keys.size(), 4);
+  ASSERT_EQ(prefixes.size(), 3);
+  ASSERT_EQ(prefixes[0], "d_0/");
+
+  keys.clear();
+  prefixes.clear();
+  bc->list_bucket_delimited(bucket, "d_2/", "/", "", f);
+  ASSERT_EQ(keys.size(), 5);
+  ASSERT_EQ(prefixes.size(), 1);
+  ASSERT_EQ(prefixes[0], "d_2/sub/");
+} /* ListDelimitedRecursive1 */
+
+TEST(BucketCache, UpdateRecursive1)
+{
+  std::string bucket{"recursive1"};
+  std::string marker{""};
+  std::vector<std::string> names;
+  sf::path tp{sf::path{bucket_root} / bucket};
+  sf::path sp{sf::path{bucket_root} / "staging1"};
+
+  /* a new nested directory is watched as it appears */
+  sf::create_directories(tp / "d_new" / "deep");
+  std::ofstream(tp / "d_new" / "deep" / "file_0").close();
+
+  /* a subtree moved in, and one moved out */
+  sf::create_directories(sp / "moved" / "sub");
+  std::ofstream(sp / "moved" / "file_0").close();
+  std::ofstream(sp / "moved" / "sub" / "file_0").close();
+  sf::rename(sp / "moved", tp / "moved");
+  sf::rename(tp / "d_0", sp / "d_0");
+
+  ASSERT_EQ(bc->fence(bucket, std::chrono::steady_clock::now() + 5s), 0);
+  /* d_new/deep was watched by the first fence's events--fence again for
+   * anything raised in it */
+  std::ofstream(tp / "d_new" / "deep" / "file_1").close();
+  ASSERT_EQ(bc->fence(bucket, std::chrono::steady_clock::now() + 5s), 0);
+
+  bc->list_bucket(bucket, marker,
+		  [&](const std::string_view& k) -> int {
+		    names.push_back(std::string{k});
+		    return 0;
+		  });
+  /* 34 - 10 (d_0) + 2 (d_new) + 2 (moved) */
+  ASSERT_EQ(names.size(), 28);
+  ASSERT_TRUE(std::find(names.begin(), names.end(), "moved/sub/file_0") != names.end());
+  ASSERT_TRUE(std::find(names.begin(), names.end(), "d_new/deep/file_1") != names.end());
+} /* UpdateRecursive1 */
+
+TEST(BucketCache, TearDownRecursive1)
+{
+  delete bc;
+  bc = nullptr;
+  sf::remove_all(sf::path{bucket_root} / "staging1");
+}
+
+TEST(BucketCache, SetupMetadata1)
+{
+  sf::path tp{sf::path{bucket_root} / "metadata1"};
+  sf::remove_all(tp);
+  sf::create_directory(tp);
+  std::ofstream ofs(tp / "file_0");
+  ofs << "0123456789";
+} /* SetupMetadata1 */
+
+TEST(BucketCache, InitBucketCacheMetadata1)
+{
+  NotifyConfig ncfg;
+  ncfg.backend = NotifyConfig::Backend::INOTIFY;
+  ncfg.metadata = true;
+  bc = new BucketCache{bucket_root, database_root, 100, 3, 3, 3, ncfg};
+}
+
+TEST(BucketCache, StatMetadata1)
+{
+  std::string bucket{"metadata1"};
+  ObjectMeta meta;
+  ASSERT_EQ(bc->stat_object(bucket, "file_0", meta), 0);
+  ASSERT_EQ(meta.size, 10);
+  ASSERT_EQ(bc->stat_object(bucket, "file_1", meta), -ENOENT);
+} /* StatMetadata1 */
+
+TEST(BucketCache, UpdateMetadata1)
+{
+  std::string bucket{"metadata1"};
+  sf::path tp{sf::path{bucket_root} / bucket};
+  ObjectMeta meta;
+
+  /* written in chunks, refreshed once closed */
+  {
+    std::ofstream ofs(tp / "file_0", std::ios::app);
+    for (int ix = 0; ix < 4; ++ix) {
+      ofs << "01234" << std::flush;
+    }
+  }
+  ASSERT_EQ(bc->fence(bucket, std::chrono::steady_clock::now() + 5s), 0);
+  ASSERT_EQ(bc->stat_object(bucket, "file_0", meta), 0);
+  ASSERT_EQ(meta.size, 30);
+
+  /* a new object is stat'd as it's added */
+  {
+    std::ofstream ofs(tp / "file_1");
+    ofs << "01234";
+  }
+  ASSERT_EQ(bc->fence(bucket, std::chrono::steady_clock::now() + 5s), 0);
+  ASSERT_EQ(bc->stat_object(bucket, "file_1", meta), 0);
+  ASSERT_EQ(meta.size, 5);
+} /* UpdateMetadata1 */
+
+TEST(BucketCache, TearDownMetadata1)
+{
+  delete bc;
+  bc = nullptr;
+}
+
+TEST(Notify, Pollnotify1)
+{
+  int ndirs = 50;
+  sf::path tp{sf::path{bucket_root} / "poll1"};
+  sf::remove_all(tp);
+  for (int ix = 0; ix < ndirs; ++ix) {
+    sf::create_directories(tp / fmt::format("b{}", ix));
+  }
+  Recorder rec;
+  NotifyConfig nc;
+  nc.backend = NotifyConfig::Backend::POLL;
+  nc.stat_rate = 10;
+  auto un = Notify::factory(&rec, tp.string(), nc);
+  auto pn = dynamic_cast<Pollnotify*>(un.get());
+  ASSERT_NE(pn, nullptr);
+  for (int ix = 0; ix < ndirs; ++ix) {
+    ASSERT_EQ(pn->add_watch(fmt::format("b{}", ix), nullptr), 0);
+  }
+  ASSERT_EQ(pn->counts().polled, ndirs);
+
+  /* a fence checks at once, whatever the rate */
+  std::ofstream(tp / "b0" / "obj_0").close();
+  ASSERT_EQ(pn->fence("b0", std::chrono::steady_clock::now() + 5s), 0);
+  auto ev = rec.of("b0");
+  ASSERT_EQ(ev.size(), 1);
+  ASSERT_EQ(ev[0].first, Notifiable::EventType::ADD);
+  ASSERT_EQ(ev[0].second, "obj_0");
+
+  /* the watches fall due every 100ms at first, several hundred checks a
+   * second, but they're held to stat_rate (and what it banked) */
+  uint64_t checks = pn->counts().checks;
+  std::this_thread::sleep_for(1s);
+  checks = pn->counts().checks - checks;
+  ASSERT_GT(checks, 0);
+  ASSERT_LE(checks, 2 * nc.stat_rate);
+
+  /* a removed watch delivers nothing more */
+  ASSERT_EQ(pn->remove_watch("b0"), 0);
+  ASSERT_EQ(pn->counts().polled, ndirs - 1);
+  sf::remove(tp / "b0" / "obj_0");
+  ASSERT_EQ(pn->fence("b0", std::chrono::steady_clock::now() + 5s), 0);
+  std::this_thread::sleep_for(200ms);
+  ASSERT_EQ(rec.of("b0").size(), 1);
+  un.reset();
+  sf::remove_all(tp);
+} /* Pollnotify1 */
+
+TEST(Notify, Fanotify1)
+{
+#if defined(linux) && defined(FAN_REPORT_DFID_NAME)
+  sf::path tp{sf::path{bucket_root} / "fan1"};
+  sf::remove_all(tp);
+  sf::create_directories(tp / "b0");
+  sf::create_directories(tp / "b1");
+  int ffd = Fanotify::init(tp.string());
+  if (ffd == -1) {
+    GTEST_SKIP() << "fanotify unavailable: " << errno;
+  }
+  close(ffd);
+  Recorder rec;
+  NotifyConfig nc;
+  nc.backend = NotifyConfig::Backend::FANOTIFY;
+  auto un = Notify::factory(&rec, tp.string(), nc);
+  auto fn = dynamic_cast<Fanotify*>(un.get());
+  ASSERT_NE(fn, nullptr);
+  ASSERT_EQ(fn->add_watch("b0", nullptr), 0);
+  ASSERT_EQ(fn->add_watch("b1", nullptr), 0);
+  ASSERT_EQ(fn->counts().watched, 2);
+
+  /* one mark covers both, and a fence drains it */
+  std::ofstream(tp / "b0" / "obj_0").close();
+  std::ofstream(tp / "b1" / "obj_1").close();
+  ASSERT_EQ(fn->fence("b1", std::chrono::steady_clock::now() + 5s), 0);
+  auto ev0 = rec.of("b0");
+  auto ev1 = rec.of("b1");
+  ASSERT_EQ(ev0.size(), 1);
+  ASSERT_EQ(ev0[0].first, Notifiable::EventType::ADD);
+  ASSERT_EQ(ev0[0].second, "obj_0");
+  ASSERT_EQ(ev1.size(), 1);
+  ASSERT_EQ(ev1[0].second, "obj_1");
+
+  /* nor does anything reach a removed watch */
+  ASSERT_EQ(fn->remove_watch("b0"), 0);
+  ASSERT_EQ(fn->counts().watched, 1);
+  sf::remove(tp / "b0" / "obj_0");
+  sf::remove(tp / "b1" / "obj_1");
+  ASSERT_EQ(fn->fence("b1", std::chrono::steady_clock::now() + 5s), 0);
+  ASSERT_EQ(rec.of("b0").size(), 1);
+  ev1 = rec.of("b1");
+  ASSERT_EQ(ev1.size(), 2);
+  ASSERT_EQ(ev1[1].first, Notifiable::EventType::REMOVE);
+  un.reset();
+  sf::remove_all(tp);
+#else
+  GTEST_SKIP() << "fanotify not built in";
+#endif
+} /* Fanotify1 */
+
 int main (int argc, char *argv[])
 {
   ::testing::InitGoogleTest(&argc, argv);
@@ -10,10 +10,70 @@ namespace file::listing {
 
   std::unique_ptr<Notify> Notify::factory(Notifiable* n, const std::string& bucket_root)
   {
+    return factory(n, bucket_root, NotifyConfig());
+  } /* Notify::factory */
+
+  std::unique_ptr<Notify> Notify::factory(Notifiable* n, const std::string& bucket_root,
+					  const NotifyConfig& config)
+  {
+    using Backend = NotifyConfig::Backend;
+    const auto make_poll = [&]() {
+      auto pn = new Pollnotify(n, bucket_root);
+      pn->set_stat_rate(config.stat_rate);
+      pn->recursive = config.recursive;
+      pn->metadata = config.metadata;
+      return pn;
+    };
 #ifdef linux
-    return std::unique_ptr<Notify>(new Inotify(n, bucket_root));
+    Backend backend = config.backend;
+    if (backend == Backend::AUTO) {
+      /* inotify and fanotify never fire for changes made by other clients
+       * of a network or userspace filesystem */
+      if (Pollnotify::required(bucket_root)) {
+	backend = Backend::POLL;
+      }
+    }
+    if (backend == Backend::POLL) {
+      return std::unique_ptr<Notify>(make_poll());
+    }
+#ifdef FAN_REPORT_DFID_NAME
+    /* fanotify reports events by directory handle, and would need one per
+     * subdirectory mapped for trees; its mark doesn't cover writes */
+    if (((backend == Backend::AUTO) ||
+	 (backend == Backend::FANOTIFY)) &&
+	(! config.recursive) && (! config.metadata)) {
+      /* one filesystem mark covers every bucket, with no per-watch limit or
+       * kernel memory, but needs CAP_SYS_ADMIN */
+      int ffd = Fanotify::init(bucket_root);
+      if (ffd != -1) {
+	return std::unique_ptr<Notify>(new Fanotify(n, bucket_root, ffd));
+      }
+      if (backend == Backend::FANOTIFY) {
+	std::cerr << fmt::format("{} fanotify on {} failed with {}, using inotify",
+				 __func__, bucket_root, errno) << std::endl;
+      }
+    } else if (backend == Backend::FANOTIFY) {
+      std::cerr << fmt::format("{} fanotify can't serve {} mode, using inotify",
+			       __func__, config.recursive ? "recursive" : "metadata")
+		<< std::endl;
+    }
+#else
+    if (backend == Backend::FANOTIFY) {
+      std::cerr << fmt::format("{} fanotify not built in, using inotify",
+			       __func__) << std::endl;
+    }
+#endif
+    /* inotify, within a watch budget */
+    auto in = new Inotify(n, bucket_root, config.inotify_shards);
+    in->recursive = config.recursive;
+    if (config.metadata) {
+      in->set_metadata(config.update_debounce);
+    }
+    auto hy = new Hybrid(n, bucket_root, config.watch_budget, in, make_poll());
+    hy->recursive = config.recursive;
+    return std::unique_ptr<Notify>(hy);
 #endif /* linux */
-    return nullptr;
+    return std::unique_ptr<Notify>(make_poll());
   } /* Notify::factory */
 
 } // namespace file::listing
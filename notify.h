@@ -8,18 +8,34 @@
 #include <memory>
 #include <thread>
 #include <mutex>
+#include <shared_mutex>
 #include <condition_variable>
 #include <chrono>
 #include <optional>
 #include <filesystem>
 #include <limits>
+#include <vector>
+#include <queue>
+#include <deque>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
 #include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include "unordered_dense.h"
+#include <xxhash.h>
 #include <unistd.h>
 #include <poll.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 #ifdef linux
 #include <sys/inotify.h>
+#include <sys/fanotify.h>
 #include <sys/eventfd.h>
+#include <sys/vfs.h>
+#include <linux/magic.h>
 #endif
 #undef FMT_HEADER_ONLY
 #define FMT_HEADER_ONLY 1
@@ -36,7 +52,9 @@ namespace file::listing {
     {
       ADD = 0,
       REMOVE,
-      INVALIDATE
+      INVALIDATE,
+      REMOVE_PREFIX, /* a subtree went away (recursive mode), name ends in '/' */
+      UPDATE /* content or attributes changed (metadata mode) */
     };
 
     struct Event
@@ -56,72 +74,420 @@ namespace file::listing {
     virtual int notify(const std::string&, void*, const std::vector<Event>&) = 0;
   };
 
+  /* fences are numbered; a backend's reader samples the newest request,
+   * drains its queue, and then completes every fence it sampled */
+  class Fence
+  {
+    std::mutex mtx;
+    std::condition_variable cv;
+    uint64_t req{0};
+    uint64_t done{0};
+
+  public:
+    uint64_t request() {
+      std::unique_lock lk{mtx};
+      return ++req;
+    }
+
+    uint64_t sample() {
+      std::unique_lock lk{mtx};
+      return req;
+    }
+
+    void complete(uint64_t f) {
+      {
+	std::unique_lock lk{mtx};
+	done = std::max(done, f);
+      }
+      cv.notify_all();
+    }
+
+    int wait(uint64_t f, std::chrono::steady_clock::time_point deadline) {
+      std::unique_lock lk{mtx};
+      if (! cv.wait_until(lk, deadline, [this, f]{ return done >= f; })) {
+	return -ETIMEDOUT;
+      }
+      return 0;
+    }
+  }; /* Fence */
+
+  struct NotifyConfig
+  {
+    enum class Backend : uint8_t
+    {
+      AUTO = 0, /* by filesystem type and privilege */
+      INOTIFY, /* inotify within watch_budget, polling beyond */
+      FANOTIFY, /* as INOTIFY, logged, where fanotify can't serve (needs
+		 * CAP_SYS_ADMIN, and neither recursive nor metadata) */
+      POLL
+    };
+
+    Backend backend{Backend::AUTO};
+
+    /* inotify watches kept for the hottest buckets; 0 derives it from
+     * fs.inotify.max_user_watches */
+    uint32_t watch_budget{0};
+
+    /* stat calls per second, over all polled directories */
+    uint32_t stat_rate{1000};
+
+    /* inotify instances, each with a reader thread; 0 picks by core
+     * count */
+    uint32_t inotify_shards{0};
+
+    /* buckets are trees: objects are named by their path relative to the
+     * bucket, and nested directories are watched too */
+    bool recursive{false};
+
+    /* deliver UPDATE for objects written or changed in place; with
+     * inotify, a run of writes to one name is delivered once it has been
+     * quiet for update_debounce, or when the writer closes it; polling
+     * compares each object's mtime and size, a stat apiece */
+    bool metadata{false};
+    std::chrono::milliseconds update_debounce{200};
+  }; /* NotifyConfig */
+
   class Notify
   {
     Notifiable* n;
     sf::path rp;
+    bool recursive{false}; /* set by factory, before any watch */
 
     Notify(Notifiable* n, const std::string& bucket_root)
       : n(n), rp(bucket_root)
       {}
 
     friend class Inotify;
+    friend class Fanotify;
+    friend class Pollnotify;
+    friend class Hybrid;
   public:
+    struct Counts
+    {
+      uint64_t watched{0}; /* kernel watches (or marked buckets) */
+      uint64_t polled{0};
+      uint64_t promoted{0};
+      uint64_t demoted{0};
+      uint64_t overflows{0}; /* kernel event queue overflows */
+      uint64_t checks{0}; /* polled directories stat'd (and maybe scanned) */
+    };
+
     static std::unique_ptr<Notify> factory(Notifiable* n, const std::string& bucket_root);
+    static std::unique_ptr<Notify> factory(Notifiable* n, const std::string& bucket_root,
+					   const NotifyConfig& config);
     
     virtual int add_watch(const std::string& dname, void* opaque) = 0;
     virtual int remove_watch(const std::string& dname) = 0;
+
+    /* watch bucket_root itself; its events (buckets created, removed or
+     * renamed) are delivered with an empty bucket name */
+    virtual int watch_root(void* opaque) {
+      return add_watch(std::string(), opaque);
+    }
+
+    /* wait until every change to dname queued before the call has been
+     * delivered (and so applied) by notify, or until deadline; returns 0 or
+     * -ETIMEDOUT */
+    virtual int fence(const std::string& dname,
+		      std::chrono::steady_clock::time_point deadline) = 0;
+
+    /* a hint that dname was just listed */
+    virtual void touch(const std::string& dname)
+      {}
+
+    virtual Counts counts() = 0;
+
     virtual ~Notify()
       {}
   }; /* Notify */
 
 #ifdef linux
+  /* watches are spread over several inotify instances ("shards") by a hash
+   * of the bucket name (as Bucket::hk), each with its own reader thread and
+   * kernel queue, so event intake scales with cores and an overflow only
+   * invalidates the buckets of one shard */
   class Inotify : public Notify
   {
-    static constexpr uint32_t rd_size = 8192;
+    static constexpr uint32_t rd_size_min = 65536;
+    static constexpr uint32_t rd_size_max = 1 << 20;
     static constexpr uint32_t aw_mask = IN_ALL_EVENTS &
       ~(IN_MOVE_SELF|IN_OPEN|IN_ACCESS|IN_ATTRIB|IN_CLOSE_WRITE|IN_CLOSE_NOWRITE|IN_MODIFY|IN_DELETE_SELF);
+    static constexpr uint32_t md_mask = IN_ATTRIB|IN_CLOSE_WRITE|IN_MODIFY;
 
     static constexpr uint64_t sig_shutdown = std::numeric_limits<uint64_t>::max() - 0xdeadbeef;
+    static constexpr uint64_t seed = 8675309; /* as Bucket::seed */
 
     class WatchRecord
     {
     public:
       int wd;
+      /* bucket, or in recursive mode bucket/sub/dir; the only copy, the
+       * registry's name index points here */
       std::string name;
-      void* opaque;
+      uint32_t blen; /* bucket name length */
+      std::atomic<void*> opaque; /* replaced when watched again */
+      WatchRecord* top; /* the bucket's watch */
+      WatchRecord* parent{nullptr};
+      std::vector<WatchRecord*> children; /* (registry mtx) */
     public:
-      WatchRecord(int wd, const std::string& name, void* opaque) noexcept
-	: wd(wd), name(name), opaque(opaque)
+      WatchRecord(int wd, const std::string& name, uint32_t blen, void* opaque) noexcept
+	: wd(wd), name(name), blen(blen), opaque(opaque), top(this)
 	{}
 
-      WatchRecord(WatchRecord&& wr) noexcept
-	: wd(wr.wd), name(wr.name), opaque(wr.opaque)
+      /* directory relative to the bucket, "" for the bucket itself */
+      std::string_view prefix() const {
+	return (name.size() > blen) ?
+	  std::string_view(name).substr(blen + 1) : std::string_view();
+      }
+    }; /* WatchRecord */
+
+    /* wd -> WatchRecord, for one reader (the shard's ev_loop) and any
+     * number of writers. The reader probes an open-addressed table of
+     * atomic pointers without locks; writers serialize on mtx and retire
+     * removed records (and outgrown tables) until the reader has passed a
+     * quiescent state (QSBR) */
+    class Registry
+    {
+      using name_map_t = ankerl::unordered_dense::map<std::string_view, WatchRecord*>;
+
+      static constexpr uint32_t min_slots = 64;
+      static inline WatchRecord* const tombstone =
+	reinterpret_cast<WatchRecord*>(uintptr_t(1));
+
+      struct Table
+      {
+	uint32_t mask;
+	std::unique_ptr<std::atomic<WatchRecord*>[]> slots;
+
+	Table(uint32_t nslots)
+	  : mask(nslots - 1), slots(new std::atomic<WatchRecord*>[nslots])
+	  {
+	    for (uint32_t ix = 0; ix < nslots; ++ix) {
+	      slots[ix].store(nullptr, std::memory_order_relaxed);
+	    }
+	  }
+
+	uint32_t size() const {
+	  return mask + 1;
+	}
+
+	static uint32_t hash(int wd) {
+	  return uint32_t(wd) * 0x9e3779b1U;
+	}
+      }; /* Table */
+
+      struct Retired
+      {
+	uint64_t epoch;
+	std::unique_ptr<WatchRecord> wr;
+	std::unique_ptr<Table> t;
+      };
+
+      std::mutex mtx;
+      std::atomic<Table*> table;
+      uint32_t used{0}; /* live + tombstones */
+      std::atomic<uint32_t> live{0};
+      name_map_t names;
+      std::vector<Retired> retired;
+
+      /* reader epoch: 0 while offline (blocked in poll), otherwise the
+       * global epoch it last observed at a quiescent point */
+      std::atomic<uint64_t> epoch{1};
+      std::atomic<uint64_t> reader_epoch{0};
+
+      void retire(std::unique_ptr<WatchRecord> wr, std::unique_ptr<Table> t) {
+	/* unpublished before the bump, so a reader at >= e can't see it */
+	uint64_t e = epoch.fetch_add(1) + 1;
+	retired.push_back(Retired{e, std::move(wr), std::move(t)});
+      }
+
+      void reclaim() {
+	auto r = reader_epoch.load();
+	std::erase_if(retired, [r](const Retired& elt) {
+	  return (r == 0) || (r >= elt.epoch);
+	});
+      }
+
+      void insert(Table* t, WatchRecord* wr) {
+	for (uint32_t ix = Table::hash(wr->wd);; ++ix) {
+	  auto& slot = t->slots[ix & t->mask];
+	  auto p = slot.load(std::memory_order_relaxed);
+	  if ((! p) || (p == tombstone)) {
+	    if (! p) {
+	      ++used;
+	    }
+	    slot.store(wr, std::memory_order_release);
+	    return;
+	  }
+	}
+      }
+
+      /* rebuild into a table sized for the live set, dropping tombstones */
+      void rehash() {
+	auto ot = table.load(std::memory_order_relaxed);
+	uint32_t nslots = min_slots;
+	while (nslots < (live + 1) * 4) {
+	  nslots <<= 1;
+	}
+	auto nt = new Table(nslots);
+	used = 0;
+	for (uint32_t ix = 0; ix < ot->size(); ++ix) {
+	  auto p = ot->slots[ix].load(std::memory_order_relaxed);
+	  if (p && (p != tombstone)) {
+	    insert(nt, p);
+	  }
+	}
+	table.store(nt);
+	retire(nullptr, std::unique_ptr<Table>(ot));
+      }
+
+    public:
+      Registry()
+	: table(new Table(min_slots))
 	{}
 
-      WatchRecord& operator=(WatchRecord&& wr) {
-	wd = wr.wd;
-	name = std::move(wr.name);
-	opaque = wr.opaque;
-	return *this;
+      /* reader side */
+      void online() {
+	reader_epoch.store(epoch.load());
       }
-    }; /* WatchRecord */
 
-    using wd_callback_map_t = ankerl::unordered_dense::map<int, WatchRecord>;
-    using wd_remove_map_t = ankerl::unordered_dense::map<std::string, int>;
+      void offline() {
+	reader_epoch.store(0);
+      }
 
-    int wfd, efd;
-    std::thread thrd;
-    wd_callback_map_t wd_callback_map;
-    wd_remove_map_t wd_remove_map;
-    bool shutdown{false};
+      /* valid until the reader's next online()/offline() */
+      WatchRecord* find(int wd) {
+	auto t = table.load(std::memory_order_acquire);
+	for (uint32_t ix = Table::hash(wd);; ++ix) {
+	  auto p = t->slots[ix & t->mask].load(std::memory_order_acquire);
+	  if (! p) {
+	    return nullptr;
+	  }
+	  if ((p != tombstone) && (p->wd == wd)) {
+	    return p;
+	  }
+	}
+      }
+
+      template <typename F>
+      void for_each(F func) {
+	auto t = table.load(std::memory_order_acquire);
+	for (uint32_t ix = 0; ix < t->size(); ++ix) {
+	  auto p = t->slots[ix].load(std::memory_order_acquire);
+	  if (p && (p != tombstone)) {
+	    func(*p);
+	  }
+	}
+      }
+
+      /* writer side; add_fn makes the kernel watch, under mtx so that a
+       * racing remove can't slip in between; a subdirectory's watch hangs
+       * off its parent's, and is refused if that is gone; watching a name
+       * again (a new incarnation of its bucket) takes the new opaque */
+      template <typename F>
+      int add(const std::string& name, uint32_t blen, void* opaque, F add_fn) {
+	std::unique_lock guard{mtx};
+	const auto& it = names.find(name);
+	if (it != names.end()) {
+	  it->second->opaque = opaque;
+	  return it->second->wd;
+	}
+	WatchRecord* parent{nullptr};
+	if (name.size() > blen) {
+	  const auto& pit = names.find(
+	    std::string_view(name).substr(0, name.rfind('/')));
+	  if (pit == names.end()) {
+	    return -1;
+	  }
+	  parent = pit->second;
+	}
+	int wd = add_fn();
+	if ((wd == -1) || find(wd)) {
+	  /* failed, or another name for a watched inode */
+	  return wd;
+	}
+	reclaim();
+	auto t = table.load(std::memory_order_relaxed);
+	if ((used + 1) * 4 > t->size() * 3) {
+	  rehash();
+	  t = table.load(std::memory_order_relaxed);
+	}
+	auto wr = new WatchRecord(wd, name, blen, opaque);
+	if (parent) {
+	  wr->parent = parent;
+	  wr->top = parent->top;
+	  parent->children.push_back(wr);
+	}
+	insert(t, wr);
+	names.insert(name_map_t::value_type(wr->name, wr));
+	++live;
+	return wd;
+      }
+
+    private:
+      /* LOCKED */
+      template <typename F>
+      int remove_tree(WatchRecord* wr, F& rm_fn) {
+	for (auto child : wr->children) {
+	  (void) remove_tree(child, rm_fn);
+	}
+	names.erase(std::string_view(wr->name));
+	int r = rm_fn(wr->wd);
+	auto t = table.load(std::memory_order_relaxed);
+	for (uint32_t ix = Table::hash(wr->wd);; ++ix) {
+	  auto& slot = t->slots[ix & t->mask];
+	  if (slot.load(std::memory_order_relaxed) == wr) {
+	    slot.store(tombstone, std::memory_order_release);
+	    break;
+	  }
+	}
+	--live;
+	retire(std::unique_ptr<WatchRecord>(wr), nullptr);
+	return r;
+      }
+
+    public:
+      /* removes name's watch and those of every directory below it; if
+       * opaque is given, only while the watch still carries it */
+      template <typename F>
+      int remove(const std::string& name, F rm_fn, void* opaque = nullptr) {
+	std::unique_lock guard{mtx};
+	const auto& it = names.find(name);
+	if (it == names.end()) {
+	  return 0;
+	}
+	if (opaque && (it->second->opaque != opaque)) {
+	  return 0;
+	}
+	auto wr = it->second;
+	if (wr->parent) {
+	  std::erase(wr->parent->children, wr);
+	}
+	int r = remove_tree(wr, rm_fn);
+	reclaim();
+	return r;
+      }
+
+      uint32_t size() const {
+	return live;
+      }
+
+      ~Registry() {
+	/* the reader has exited */
+	for_each([](WatchRecord& wr) {
+	  delete &wr;
+	});
+	delete table.load();
+      }
+    }; /* Registry */
 
     class AlignedBuf
     {
       char* m;
+      uint32_t sz;
     public:
-      AlignedBuf() {
-	m = static_cast<char*>(aligned_alloc(__alignof__(struct inotify_event), rd_size));
+      AlignedBuf(uint32_t sz) : sz(sz) {
+	m = static_cast<char*>(aligned_alloc(__alignof__(struct inotify_event), sz));
 	if (! m) [[unlikely]] {
 	  std::cerr << fmt::format("{} buffer allocation failure", __func__) << std::endl;
 	  abort();
@@ -133,81 +499,574 @@ namespace file::listing {
       char* get() {
 	return m;
       }
+      uint32_t size() const {
+	return sz;
+      }
     }; /* AlignedBuf */
-    
+
+    class Shard
+    {
+    public:
+      Inotify* in;
+      int wfd, efd;
+      std::thread thrd;
+      Registry reg;
+      Fence fences;
+      std::atomic<uint64_t> overflows{0};
+
+      /* objects being written, by bucket '\0' key; an UPDATE goes out
+       * after a quiet interval, bounded so a steady writer is still seen */
+      struct Update
+      {
+	std::string bname;
+	void* opaque;
+	std::chrono::steady_clock::time_point first;
+	std::chrono::steady_clock::time_point due;
+      };
+      ankerl::unordered_dense::map<std::string, Update> updates;
+
+      Shard(Inotify* in)
+	: in(in)
+	{
+	  wfd = inotify_init1(IN_NONBLOCK);
+	  if (wfd == -1) {
+	    std::cerr << fmt::format("{} inotify_init1 failed with {}", __func__, wfd) << std::endl;
+	    exit(1);
+	  }
+	  efd = eventfd(0, EFD_NONBLOCK);
+	  /* start the reader only once both fds are valid */
+	  thrd = std::thread(&Shard::ev_loop, this);
+	}
+
+      void signal_shutdown() {
+	uint64_t msg{sig_shutdown};
+	(void) write(efd, &msg, sizeof(uint64_t));
+      }
+
+      /* every watch of this shard missed events */
+      void invalidate_all() {
+	std::vector<Notifiable::Event> evec;
+	evec.emplace_back(Notifiable::Event(Notifiable::EventType::INVALIDATE, std::nullopt));
+	std::vector<const WatchRecord*> wrs;
+	reg.for_each([&](const WatchRecord& wr) {
+	  if (wr.top == &wr) {
+	    wrs.push_back(&wr);
+	  }
+	});
+	/* records removed meanwhile stay allocated until we are quiescent */
+	for (const auto wr : wrs) {
+	  in->n->notify(wr->name, wr->opaque, evec);
+	}
+      }
+
+      static std::string update_key(const std::string& bname,
+				    const std::string_view& key) {
+	std::string uk{bname};
+	uk.push_back('\0');
+	uk.append(key);
+	return uk;
+      }
+
+      void debounce(const WatchRecord* top, const std::string_view& key) {
+	auto now = std::chrono::steady_clock::now();
+	auto [it, inserted] = updates.try_emplace(
+	  update_key(top->name, key), Update{top->name, top->opaque, now, now});
+	auto& u = it->second;
+	u.due = std::min(now + in->debounce, u.first + (in->debounce * 5));
+      }
+
+      /* ms until the next debounced UPDATE is due, for poll */
+      int update_timeout() {
+	if (updates.empty()) {
+	  return -1;
+	}
+	auto due = std::chrono::steady_clock::time_point::max();
+	for (const auto& [uk, u] : updates) {
+	  due = std::min(due, u.due);
+	}
+	auto ms = std::chrono::ceil<std::chrono::milliseconds>(
+	  due - std::chrono::steady_clock::now()).count();
+	return std::max(int(ms), 0);
+      }
+
+      /* deliver the UPDATEs that are due (or all of them), a batch per
+       * bucket */
+      void flush_updates(bool all) {
+	if (updates.empty()) {
+	  return;
+	}
+	auto now = std::chrono::steady_clock::now();
+	std::vector<std::pair<std::string, Update>> due;
+	std::erase_if(updates, [&](auto& elt) {
+	  if (all || (elt.second.due <= now)) {
+	    due.push_back({elt.first, elt.second});
+	    return true;
+	  }
+	  return false;
+	});
+	std::sort(due.begin(), due.end(), [](const auto& l, const auto& r) {
+	  return l.first < r.first;
+	});
+	std::vector<Notifiable::Event> evec;
+	for (size_t ix = 0; ix < due.size(); ++ix) {
+	  const auto& [uk, u] = due[ix];
+	  evec.emplace_back(Notifiable::Event(Notifiable::EventType::UPDATE,
+					      std::string_view(uk).substr(u.bname.size() + 1)));
+	  if ((ix + 1 == due.size()) ||
+	      (due[ix + 1].second.bname != u.bname)) {
+	    in->n->notify(u.bname, u.opaque, evec);
+	    evec.clear();
+	  }
+	}
+      }
+
+      void ev_loop() {
+	auto up_buf = std::make_unique<AlignedBuf>(rd_size_min);
+	struct inotify_event* event;
+	ssize_t len;
+	int npoll;
+
+	nfds_t nfds{2};
+	struct pollfd fds[2] = {{wfd, POLLIN}, {efd, POLLIN}};
+
+	while(! in->shutdown) {
+	  /* no registry references are held across poll */
+	  reg.offline();
+	  npoll = poll(fds, nfds, update_timeout()); /* for up to 10 fds, poll is fast as epoll */
+	  if (in->shutdown) {
+	    return;
+	  }
+	  reg.online();
+	  if (npoll == 0) {
+	    flush_updates(false);
+	    continue;
+	  }
+	  if (npoll == -1) {
+	    if (errno == EINTR) {
+	      continue;
+	    }
+	    // XXX
+	  }
+	  if (npoll > 0) {
+	    uint64_t fence{0};
+	    if (fds[1].revents & POLLIN) {
+	      uint64_t msg;
+	      (void) read(efd, &msg, sizeof(msg));
+	      fence = fences.sample();
+	    }
+	    /* drain the queue, so that a fence requested before we started
+	     * covers every event queued before it */
+	    for (;;) {
+	      char* buf = up_buf->get();
+	      len = read(wfd, buf, up_buf->size());
+	      if (len <= 0) {
+		break; // hopefully, was EAGAIN
+	      }
+	      std::vector<Notifiable::Event> evec;
+	      std::deque<std::string> keys; /* event names we had to build */
+	      ankerl::unordered_dense::set<std::string_view> updated;
+	      const WatchRecord* batch_wr{nullptr};
+	      /* deliver runs of events on the same bucket as one batch */
+	      const auto flush = [&]() {
+		if (evec.size() > 0) {
+		  in->n->notify(batch_wr->name, batch_wr->opaque, evec);
+		  evec.clear();
+		  keys.clear();
+		  updated.clear();
+		}
+	      };
+	      for (char* ptr = buf; ptr < buf + len;
+		   ptr += sizeof(struct inotify_event) + event->len) {
+		event = reinterpret_cast<struct inotify_event*>(ptr);
+		if (event->mask & IN_Q_OVERFLOW) [[unlikely]] {
+		  /* cache blown (the event has no watch), invalidate the
+		   * whole shard */
+		  flush();
+		  ++overflows;
+		  invalidate_all();
+		  batch_wr = nullptr;
+		  continue;
+		}
+		const auto wr = reg.find(event->wd);
+		//std::cout << fmt::format("event! {}", event->name) << std::endl;
+		if (! wr) [[unlikely]] {
+		  /* non-destructive race, it happens */
+		  continue;
+		}
+		if (wr->top != batch_wr) {
+		  flush();
+		  batch_wr = wr->top;
+		}
+		/* in recursive mode, directories are subtrees, not objects
+		 * (the root's are buckets) */
+		bool tree = in->recursive && (event->mask & IN_ISDIR) &&
+		  (! wr->name.empty());
+		std::string_view key{event->name};
+		if (wr != wr->top) {
+		  keys.push_back(fmt::format("{}/{}", wr->prefix(), event->name));
+		  key = keys.back();
+		}
+		if ((event->mask & IN_CREATE) ||
+		    (event->mask & IN_MOVED_TO)) {
+		  if (tree) {
+		    /* a subtree moved in raises no events of its own */
+		    (void) in->watch_tree(*this, fmt::format("{}/{}", wr->name, event->name),
+					  wr->blen, wr->opaque, &keys, &evec);
+		  } else {
+		    /* new object in dir */
+		    evec.emplace_back(Notifiable::Event(Notifiable::EventType::ADD, key));
+		  }
+		} else if ((event->mask & IN_DELETE) ||
+			   (event->mask & IN_MOVED_FROM)) {
+		  if (tree) {
+		    keys.push_back(fmt::format("{}/", key));
+		    evec.emplace_back(Notifiable::Event(Notifiable::EventType::REMOVE_PREFIX, keys.back()));
+		    (void) in->unwatch(*this, fmt::format("{}/{}", wr->name, event->name));
+		  } else {
+		    /* object removed from dir */
+		    if (! updates.empty()) {
+		      updates.erase(update_key(wr->top->name, key));
+		    }
+		    evec.emplace_back(Notifiable::Event(Notifiable::EventType::REMOVE, key));
+		  }
+		} else if (event->mask & md_mask) {
+		  /* objects only--not the root's buckets, nor directories */
+		  if (wr->name.empty() || (event->mask & IN_ISDIR)) {
+		    continue;
+		  }
+		  if (event->mask & IN_MODIFY) {
+		    /* mid-write, wait for it to settle */
+		    debounce(wr->top, key);
+		  } else {
+		    /* closed after writing, or attributes changed */
+		    if (! updates.empty()) {
+		      updates.erase(update_key(wr->top->name, key));
+		    }
+		    if (updated.insert(key).second) {
+		      evec.emplace_back(Notifiable::Event(Notifiable::EventType::UPDATE, key));
+		    }
+		  }
+		}
+	      } /* events */
+	      flush();
+	      /* a nearly full read means we are falling behind, read more
+	       * per syscall */
+	      if ((uint64_t(len) > (up_buf->size() / 4 * 3)) &&
+		  (up_buf->size() < rd_size_max)) {
+		up_buf = std::make_unique<AlignedBuf>(up_buf->size() * 2);
+	      }
+	      /* quiescent point, lets writers free what they removed */
+	      reg.online();
+	    } /* drain */
+	    /* a fence doesn't wait out the debounce */
+	    flush_updates(fence != 0);
+	    if (fence) {
+	      fences.complete(fence);
+	    }
+	  } /* n > 0 */
+	}
+      } /* ev_loop */
+
+      ~Shard() {
+	signal_shutdown();
+	thrd.join();
+	close(efd);
+	close(wfd);
+      }
+    }; /* Shard */
+
+    std::vector<std::unique_ptr<Shard>> shards;
+    std::atomic<bool> shutdown{false};
+    uint32_t mask{aw_mask};
+    std::chrono::milliseconds debounce{200};
+
+    Shard& shard_of(const std::string& dname) {
+      return *(shards[XXH64(dname.c_str(), dname.length(), seed) % shards.size()]);
+    }
+
+    static uint32_t default_shards() {
+      return std::clamp(std::thread::hardware_concurrency() / 2, 1U, 4U);
+    }
+
+    Inotify(Notifiable* n, const std::string& bucket_root, uint32_t nshards)
+      : Notify(n, bucket_root)
+      {
+	if (! nshards) {
+	  nshards = default_shards();
+	}
+	for (uint32_t ix = 0; ix < nshards; ++ix) {
+	  shards.push_back(std::make_unique<Shard>(this));
+	}
+      }
+
+    /* watch path (bucket, or bucket/sub/dir), and in recursive mode every
+     * directory below it, all on the bucket's shard; if evec is given, an
+     * ADD is queued for each object found (named in keys) */
+    int watch_tree(Shard& shard, const std::string& path, uint32_t blen,
+		   void* opaque, std::deque<std::string>* keys,
+		   std::vector<Notifiable::Event>* evec) {
+      sf::path wp{rp / path};
+      int wd = shard.reg.add(path, blen, opaque, [&]() {
+	return inotify_add_watch(shard.wfd, wp.c_str(), mask);
+      });
+      if (wd == -1) {
+	if (path.size() == blen) {
+	  std::cerr << fmt::format("{} inotify_add_watch {} failed with {}", __func__, path, wd) << std::endl;
+	}
+	return wd;
+      }
+      if (! (recursive && (blen > 0))) {
+	return wd;
+      }
+      std::error_code ec;
+      for (auto it = sf::directory_iterator{wp, ec};
+	   (! ec) && (it != sf::directory_iterator{}); it.increment(ec)) {
+	auto sub = fmt::format("{}/{}", path, it->path().filename().string());
+	std::error_code sec;
+	if (sf::is_directory(it->symlink_status(sec))) {
+	  (void) watch_tree(shard, sub, blen, opaque, keys, evec);
+	} else if (evec) {
+	  keys->push_back(sub.substr(blen + 1));
+	  evec->emplace_back(Notifiable::Event(Notifiable::EventType::ADD, keys->back()));
+	}
+      }
+      return wd;
+    }
+
+    int unwatch(Shard& shard, const std::string& path,
+		void* opaque = nullptr) {
+      return shard.reg.remove(path, [&](int wd) {
+	int r = inotify_rm_watch(shard.wfd, wd);
+	if ((r == -1) && (errno != EINVAL) /* directory already gone */) {
+	  std::cerr << fmt::format("{} inotify_rm_watch {} failed with {}", __func__, path, wd) << std::endl;
+	}
+	return r;
+      }, opaque);
+    }
+
+    /* for Hybrid: removes dname's watch only if it is still opaque's */
+    int remove_watch_if(const std::string& dname, void* opaque) {
+      return unwatch(shard_of(dname), dname, opaque);
+    }
+
+    /* before any watch is added */
+    void set_metadata(std::chrono::milliseconds _debounce) {
+      mask = aw_mask | md_mask;
+      debounce = _debounce;
+    }
+
+    friend class Notify;
+    friend class Hybrid;
+  public:
+    virtual int add_watch(const std::string& dname, void* opaque) override {
+      return watch_tree(shard_of(dname), dname, dname.size(), opaque,
+			nullptr, nullptr);
+    }
+
+    virtual int remove_watch(const std::string& dname) override {
+      return unwatch(shard_of(dname), dname);
+    }
+
+    virtual int fence(const std::string& dname,
+		      std::chrono::steady_clock::time_point deadline) override {
+      /* dname's changes are all queued on its shard */
+      auto& shard = shard_of(dname);
+      uint64_t f = shard.fences.request();
+      uint64_t msg{1};
+      (void) write(shard.efd, &msg, sizeof(uint64_t));
+      return shard.fences.wait(f, deadline);
+    }
+
+    virtual Counts counts() override {
+      Counts c;
+      for (const auto& shard : shards) {
+	c.watched += shard->reg.size();
+	c.overflows += shard->overflows;
+      }
+      return c;
+    }
+
+    virtual ~Inotify() {
+      shutdown = true;
+      shards.clear();
+    }
+  };
+#endif /* linux */
+
+#if defined(linux) && defined(FAN_REPORT_DFID_NAME)
+  /* a single fanotify mark on the bucket_root filesystem replaces one
+   * inotify watch per bucket; events name their parent directory by file
+   * handle, which is resolved to a watched bucket through a handle map */
+  class Fanotify : public Notify
+  {
+    static constexpr uint32_t rd_size = 65536;
+    static constexpr uint64_t mark_mask =
+      FAN_CREATE|FAN_DELETE|FAN_MOVED_FROM|FAN_MOVED_TO|FAN_ONDIR;
+
+    static constexpr uint64_t sig_shutdown = std::numeric_limits<uint64_t>::max() - 0xdeadbeef;
+
+    class WatchRecord
+    {
+    public:
+      std::string name;
+      void* opaque;
+    public:
+      WatchRecord(const std::string& name, void* opaque) noexcept
+	: name(name), opaque(opaque)
+	{}
+    }; /* WatchRecord */
+
+    /* file handles are keyed by { handle_type, f_handle } */
+    using fh_callback_map_t = ankerl::unordered_dense::map<std::string, WatchRecord>;
+    using fh_remove_map_t = ankerl::unordered_dense::map<std::string, std::string>;
+
+    int ffd, efd;
+    std::thread thrd;
+    std::shared_mutex mtx;
+    fh_callback_map_t fh_callback_map;
+    fh_remove_map_t fh_remove_map;
+    std::atomic<bool> shutdown{false};
+    Fence fences;
+
+    static std::string handle_key(const struct file_handle* fh) {
+      std::string k(reinterpret_cast<const char*>(&fh->handle_type),
+		    sizeof(fh->handle_type));
+      k.append(reinterpret_cast<const char*>(fh->f_handle), fh->handle_bytes);
+      return k;
+    }
+
+    void invalidate_all() {
+      std::vector<Notifiable::Event> evec;
+      evec.emplace_back(Notifiable::Event(Notifiable::EventType::INVALIDATE, std::nullopt));
+      std::vector<WatchRecord> wrs;
+      {
+	std::shared_lock lk{mtx};
+	for (const auto& [k, wr] : fh_callback_map) {
+	  wrs.push_back(wr);
+	}
+      }
+      /* notify may remove watches, so never call it LOCKED */
+      for (const auto& wr : wrs) {
+	n->notify(wr.name, wr.opaque, evec);
+      }
+    }
+
     void ev_loop() {
-      std::unique_ptr<AlignedBuf> up_buf = std::make_unique<AlignedBuf>();
-      struct inotify_event* event;
-      char* buf = up_buf.get()->get();
+      std::unique_ptr<char[]> up_buf{new char[rd_size]};
+      char* buf = up_buf.get();
       ssize_t len;
       int npoll;
 
       nfds_t nfds{2};
-      struct pollfd fds[2] = {{wfd, POLLIN}, {efd, POLLIN}};
+      struct pollfd fds[2] = {{ffd, POLLIN}, {efd, POLLIN}};
 
-    restart:
       while(! shutdown) {
-	npoll = poll(fds, nfds, -1); /* for up to 10 fds, poll is fast as epoll */
+	npoll = poll(fds, nfds, -1);
 	if (shutdown) {
 	  return;
 	}
 	if (npoll == -1) {
-	  if (errno = EINTR) {
+	  if (errno == EINTR) {
 	    continue;
 	  }
 	  // XXX
 	}
 	if (npoll > 0) {
-	  len = read(wfd, buf, rd_size);
-	  if (len == -1) {
-	    continue; // hopefully, was EAGAIN
-	  }
-	  std::vector<Notifiable::Event> evec;
-	  for (char* ptr = buf; ptr < buf + len;
-	       ptr += sizeof(struct inotify_event) + event->len) {
-	    event = reinterpret_cast<struct inotify_event*>(ptr);
-	    const auto& it = wd_callback_map.find(event->wd);
-	    //std::cout << fmt::format("event! {}", event->name) << std::endl;
-	    if (it == wd_callback_map.end()) [[unlikely]] {
-	      /* non-destructive race, it happens */
-	      continue;
+	  uint64_t fence{0};
+	  if (fds[1].revents & POLLIN) {
+	    uint64_t msg;
+	    (void) read(efd, &msg, sizeof(msg));
+	    fence = fences.sample();
+	  }
+	  for (;;) {
+	    len = read(ffd, buf, rd_size);
+	    if (len <= 0) {
+	      break; // hopefully, was EAGAIN
 	    }
-	    const auto& wr = it->second;
-	    if (event->mask & IN_Q_OVERFLOW) [[unlikely]] {
-	      /* cache blown, invalidate */
-	      evec.clear();
-	      evec.emplace_back(Notifiable::Event(Notifiable::EventType::INVALIDATE, std::nullopt));
-	      n->notify(wr.name, wr.opaque, evec);
-	      goto restart;
-	    } else {
-	      if ((event->mask & IN_CREATE) ||
-		  (event->mask & IN_MOVED_TO)) {
+	    std::vector<Notifiable::Event> evec;
+	    std::string batch_key;
+	    WatchRecord batch_wr{"", nullptr};
+	    const auto flush = [&]() {
+	      if (evec.size() > 0) {
+		n->notify(batch_wr.name, batch_wr.opaque, evec);
+		evec.clear();
+	      }
+	    };
+	    /* records are 4-aligned, but the metadata's mask is a u64: copy
+	     * each header out rather than read it in place */
+	    struct fanotify_event_metadata mdc;
+	    for (ssize_t off = 0; (off + ssize_t(sizeof(mdc))) <= len;
+		 off += mdc.event_len) {
+	      memcpy(&mdc, buf + off, sizeof(mdc));
+	      if ((mdc.event_len < sizeof(mdc)) ||
+		  ((off + ssize_t(mdc.event_len)) > len)) [[unlikely]] {
+		break;
+	      }
+	      const auto md = &mdc;
+	      if (md->mask & FAN_Q_OVERFLOW) [[unlikely]] {
+		/* cache blown, invalidate everything */
+		flush();
+		invalidate_all();
+		batch_key.clear();
+		continue;
+	      }
+	      if (md->metadata_len >= md->event_len) [[unlikely]] {
+		continue;
+	      }
+	      auto fid = reinterpret_cast<struct fanotify_event_info_fid*>(
+		buf + off + md->metadata_len);
+	      if (fid->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID_NAME) [[unlikely]] {
+		continue;
+	      }
+	      auto fh = reinterpret_cast<struct file_handle*>(fid->handle);
+	      auto k = handle_key(fh);
+	      if (k != batch_key) {
+		/* deliver runs of events on the same watch as one batch */
+		flush();
+		std::shared_lock lk{mtx};
+		const auto& it = fh_callback_map.find(k);
+		if (it == fh_callback_map.end()) {
+		  /* not a bucket we cache */
+		  batch_key.clear();
+		  continue;
+		}
+		batch_key = std::move(k);
+		batch_wr = it->second;
+	      }
+	      const auto& wr = batch_wr;
+	      std::string_view name{
+		reinterpret_cast<const char*>(fh->f_handle + fh->handle_bytes)};
+	      bool add = md->mask & (FAN_CREATE|FAN_MOVED_TO);
+	      bool remove = md->mask & (FAN_DELETE|FAN_MOVED_FROM);
+	      if (add && remove) {
+		/* merged events don't say which came last; ask */
+		struct stat st;
+		sf::path p{rp / wr.name / name};
+		add = (fstatat(AT_FDCWD, p.c_str(), &st, AT_SYMLINK_NOFOLLOW) == 0);
+		remove = ! add;
+	      }
+	      if (add) {
 		/* new object in dir */
-		evec.emplace_back(Notifiable::Event(Notifiable::EventType::ADD, event->name));
-	      } else if ((event->mask & IN_DELETE) ||
-			 (event->mask & IN_MOVED_FROM)) {
+		evec.emplace_back(Notifiable::Event(Notifiable::EventType::ADD, name));
+	      } else if (remove) {
 		/* object removed from dir */
-		evec.emplace_back(Notifiable::Event(Notifiable::EventType::REMOVE, event->name));
+		evec.emplace_back(Notifiable::Event(Notifiable::EventType::REMOVE, name));
 	      }
-	    } /* !overflow */
-	    if (evec.size() > 0) {
-	      n->notify(wr.name, wr.opaque, evec);
-	    }
-	  } /* events */
+	    } /* events */
+	    flush();
+	  } /* drain */
+	  if (fence) {
+	    fences.complete(fence);
+	  }
 	} /* n > 0 */
       }
     } /* ev_loop */
 
-    Inotify(Notifiable* n, const std::string& bucket_root)
-      : Notify(n, bucket_root),
-	thrd(&Inotify::ev_loop, this)
+    Fanotify(Notifiable* n, const std::string& bucket_root, int ffd)
+      : Notify(n, bucket_root), ffd(ffd)
       {
-	wfd = inotify_init1(IN_NONBLOCK);
-	if (wfd == -1) {
-	  std::cerr << fmt::format("{} inotify_init1 failed with {}", __func__, wfd) << std::endl;
-	  exit(1);
-	}
 	efd = eventfd(0, EFD_NONBLOCK);
+	thrd = std::thread(&Fanotify::ev_loop, this);
       }
 
     void signal_shutdown() {
@@ -217,39 +1076,754 @@ namespace file::listing {
 
     friend class Notify;
   public:
+    /* returns a fanotify fd marked on bucket_root's filesystem, or -1 (and
+     * errno) if we lack the privilege, or the kernel or filesystem lacks
+     * support */
+    static int init(const std::string& bucket_root) {
+      int fd = fanotify_init(FAN_CLASS_NOTIF|FAN_REPORT_DFID_NAME|FAN_NONBLOCK|FAN_CLOEXEC,
+			     O_RDONLY);
+      if (fd == -1) {
+	return -1;
+      }
+      if (fanotify_mark(fd, FAN_MARK_ADD|FAN_MARK_FILESYSTEM, mark_mask,
+			AT_FDCWD, bucket_root.c_str()) == -1) {
+	int e = errno;
+	close(fd);
+	errno = e;
+	return -1;
+      }
+      return fd;
+    }
+
     virtual int add_watch(const std::string& dname, void* opaque) override {
       sf::path wp{rp / dname};
-      int wd = inotify_add_watch(wfd, wp.c_str(), aw_mask);
-      if (wd == -1) {
-	std::cerr << fmt::format("{} inotify_add_watch {} failed with {}", __func__, dname, wd) << std::endl;
+      union {
+	struct file_handle fh;
+	char buf[sizeof(struct file_handle) + MAX_HANDLE_SZ];
+      } u;
+      int mount_id;
+      u.fh.handle_bytes = MAX_HANDLE_SZ;
+      int r = name_to_handle_at(AT_FDCWD, wp.c_str(), &u.fh, &mount_id, 0);
+      if (r == -1) {
+	std::cerr << fmt::format("{} name_to_handle_at {} failed with {}", __func__, dname, errno) << std::endl;
       } else {
-	wd_callback_map.insert(wd_callback_map_t::value_type(wd, WatchRecord(wd, dname, opaque)));
-	wd_remove_map.insert(wd_remove_map_t::value_type(dname, wd));
+	auto k = handle_key(&u.fh);
+	std::unique_lock lk{mtx};
+	/* watched again: the new incarnation's opaque, and the handle of
+	 * the directory now at dname */
+	const auto& elt = fh_remove_map.find(dname);
+	if ((elt != fh_remove_map.end()) && (elt->second != k)) {
+	  fh_callback_map.erase(elt->second);
+	}
+	fh_callback_map.insert_or_assign(k, WatchRecord(dname, opaque));
+	fh_remove_map.insert_or_assign(dname, k);
       }
-      return wd;
+      return r;
     }
 
     virtual int remove_watch(const std::string& dname) override {
-      int r{0};
-      const auto& elt = wd_remove_map.find(dname);
-      if (elt != wd_remove_map.end()) {
-	auto& wd = elt->second;
-	r = inotify_rm_watch(wfd, wd);
-	if (r == -1) {
-	  std::cerr << fmt::format("{} inotify_rm_watch {} failed with {}", __func__, dname, wd) << std::endl;
+      std::unique_lock lk{mtx};
+      const auto& elt = fh_remove_map.find(dname);
+      if (elt != fh_remove_map.end()) {
+	fh_callback_map.erase(elt->second);
+	fh_remove_map.erase(elt);
+      }
+      return 0;
+    }
+
+    /* one queue carries every watched directory's events, so draining it
+     * fences any of them; one not watched has nothing to wait for */
+    virtual int fence(const std::string& dname,
+		      std::chrono::steady_clock::time_point deadline) override {
+      {
+	std::shared_lock lk{mtx};
+	if (! fh_remove_map.contains(dname)) {
+	  return 0;
 	}
-	wd_callback_map.erase(wd);
-	wd_remove_map.erase(std::string(dname));
       }
-      return r;
+      uint64_t f = fences.request();
+      uint64_t msg{1};
+      (void) write(efd, &msg, sizeof(uint64_t));
+      return fences.wait(f, deadline);
     }
 
-    virtual ~Inotify() {
+    virtual Counts counts() override {
+      Counts c;
+      std::shared_lock lk{mtx};
+      c.watched = fh_remove_map.size();
+      return c;
+    }
+
+    virtual ~Fanotify() {
       shutdown = true;
       signal_shutdown();
       thrd.join();
+      close(efd);
+      close(ffd);
     }
-  };
+  }; /* Fanotify */
+#endif /* linux && FAN_REPORT_DFID_NAME */
+
+  /* change detection for filesystems on which inotify never fires (NFS,
+   * FUSE, &c); a watched directory's mtime and ctime are checked on an
+   * adaptive schedule--a directory found changed is checked again soon,
+   * an unchanged one backs off--and a change is turned into ADD and
+   * REMOVE events by a sorted diff against the last scan; checks are
+   * rate-limited so that many watches can't become an i/o storm */
+  class Pollnotify : public Notify
+  {
+  public:
+    static constexpr std::chrono::milliseconds min_interval{100};
+    static constexpr std::chrono::milliseconds max_interval{30000};
+    static constexpr uint32_t default_stat_rate = 1000; /* per second */
+
+  private:
+    using clock = std::chrono::steady_clock;
+
+    /* an object as last seen; mtime and size only in metadata mode */
+    struct Entry
+    {
+      std::string name;
+      uint64_t mtime{0}; /* ns */
+      uint64_t size{0};
+
+      bool operator<(const Entry& r) const { return name < r.name; }
+    };
+
+    class WatchRecord
+    {
+    public:
+      std::string name;
+      void* opaque;
+      struct timespec mtime{0, 0};
+      struct timespec ctime{0, 0};
+      bool dirty{false}; /* mtime too recent to trust, scan regardless */
+      bool removed{false};
+      std::vector<Entry> snap; /* sorted */
+      std::chrono::milliseconds interval{min_interval};
+      uint64_t sched_seq{0}; /* only the newest schedule entry is live (mtx) */
+      uint64_t fence_req{0}; /* (mtx) */
+      uint64_t fence_done{0}; /* (mtx) */
+    public:
+      WatchRecord(const std::string& name, void* opaque) noexcept
+	: name(name), opaque(opaque)
+	{}
+    }; /* WatchRecord */
+
+    using wr_ptr = std::shared_ptr<WatchRecord>;
+    using due_t = std::tuple<clock::time_point, uint64_t, wr_ptr>;
+
+    struct DueLater
+    {
+      bool operator()(const due_t& lhs, const due_t& rhs) const
+	{ return get<0>(lhs) > get<0>(rhs); }
+    };
+
+    std::thread thrd;
+    std::mutex mtx;
+    std::condition_variable cv;
+    ankerl::unordered_dense::map<std::string, wr_ptr> watches;
+    std::priority_queue<due_t, std::vector<due_t>, DueLater> sched;
+    uint64_t fence_seq{0};
+    uint64_t n_checks{0};
+    bool shutdown{false};
+    bool metadata{false}; /* set by factory, before any watch */
+
+    /* token bucket over stat calls */
+    std::atomic<uint32_t> stat_rate{default_stat_rate};
+    double tokens{0}; /* negative in debt (see charge) */
+    clock::time_point refilled{clock::now()};
+
+    /* LOCKED */
+    void schedule(const wr_ptr& wr, clock::time_point due) {
+      sched.push(due_t(due, ++(wr->sched_seq), wr));
+    }
+
+    static bool changed(const struct timespec& l, const struct timespec& r) {
+      return (l.tv_sec != r.tv_sec) || (l.tv_nsec != r.tv_nsec);
+    }
+
+    /* the objects under wr, sorted; cost is what the scan took beyond
+     * the directory's own stat, in tokens: a directory read for each
+     * subdirectory walked, and a stat for each object in metadata mode */
+    std::vector<Entry> scan(const WatchRecord& wr, uint32_t& cost) {
+      std::vector<Entry> entries;
+      sf::path dp{rp / wr.name};
+      const auto add = [&](const sf::directory_entry& dir_entry, std::string name) {
+	Entry e{std::move(name)};
+	if (metadata) {
+	  struct stat st;
+	  ++cost;
+	  if (lstat(dir_entry.path().c_str(), &st) == 0) {
+	    e.mtime = uint64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+	    e.size = st.st_size;
+	  }
+	}
+	entries.push_back(std::move(e));
+      };
+      if (recursive && (! wr.name.empty())) {
+	/* objects by path, as BucketCache::fill */
+	for (const auto& dir_entry : sf::recursive_directory_iterator{dp}) {
+	  if (dir_entry.is_directory()) {
+	    ++cost;
+	  } else {
+	    add(dir_entry, dir_entry.path().lexically_relative(dp).generic_string());
+	  }
+	}
+      } else {
+	for (const auto& dir_entry : sf::directory_iterator{dp}) {
+	  add(dir_entry, dir_entry.path().filename().string());
+	}
+      }
+      std::sort(entries.begin(), entries.end());
+      return entries;
+    }
+
+    /* stat wr's directory, and if it changed (or force), diff it against
+     * the last scan and deliver the difference; returns true if changed,
+     * and the scan's cost (see scan) */
+    bool check(WatchRecord& wr, bool force, uint32_t& cost) {
+      struct stat st;
+      sf::path dp{rp / wr.name};
+      if (stat(dp.c_str(), &st) == -1) {
+	return false; /* gone or unreachable, the bucket layer decides */
+      }
+      /* a change deep in a tree, or to an object in place, doesn't touch
+       * the top directory */
+      bool deep = (recursive || metadata) && (! wr.name.empty());
+      if (! (force || wr.dirty || deep ||
+	     changed(st.st_mtim, wr.mtime) || changed(st.st_ctim, wr.ctime))) {
+	return false;
+      }
+      /* a change within the filesystem's timestamp granularity of now
+       * could be followed by another that leaves mtime as it is */
+      struct timespec now;
+      clock_gettime(CLOCK_REALTIME, &now);
+      wr.dirty = (now.tv_sec - st.st_mtim.tv_sec) < 2;
+      wr.mtime = st.st_mtim;
+      wr.ctime = st.st_ctim;
+
+      std::vector<Entry> entries;
+      try {
+	entries = scan(wr, cost);
+      } catch (const sf::filesystem_error& e) {
+	return false;
+      }
+      std::vector<Notifiable::Event> evec;
+      auto o = wr.snap.begin();
+      auto c = entries.begin();
+      while ((o != wr.snap.end()) || (c != entries.end())) {
+	if ((c == entries.end()) ||
+	    ((o != wr.snap.end()) && (*o < *c))) {
+	  evec.emplace_back(Notifiable::Event(Notifiable::EventType::REMOVE, o->name));
+	  ++o;
+	} else if ((o == wr.snap.end()) || (*c < *o)) {
+	  evec.emplace_back(Notifiable::Event(Notifiable::EventType::ADD, c->name));
+	  ++c;
+	} else {
+	  if ((o->mtime != c->mtime) || (o->size != c->size)) {
+	    evec.emplace_back(Notifiable::Event(Notifiable::EventType::UPDATE, c->name));
+	  }
+	  ++o;
+	  ++c;
+	}
+      }
+      if (evec.size() > 0) {
+	n->notify(wr.name, wr.opaque, evec);
+      }
+      wr.snap = std::move(entries);
+      return (evec.size() > 0);
+    } /* check */
+
+    /* LOCKED; tokens go into debt, which later checks wait out */
+    void charge(uint32_t cost) {
+      tokens -= cost;
+    }
+
+    /* LOCKED; returns time until a token is available */
+    clock::duration take_token() {
+      auto now = clock::now();
+      double rate = stat_rate;
+      tokens = std::min(rate, tokens +
+			rate * std::chrono::duration<double>(now - refilled).count());
+      refilled = now;
+      if (tokens >= 1) {
+	tokens -= 1;
+	return clock::duration::zero();
+      }
+      return std::chrono::duration_cast<clock::duration>(
+	std::chrono::duration<double>((1 - tokens) / rate));
+    }
+
+    void ev_loop() {
+      std::unique_lock lk{mtx};
+      while (! shutdown) {
+	if (sched.empty()) {
+	  cv.wait(lk);
+	  continue;
+	}
+	auto now = clock::now();
+	auto [due, seq, wr] = sched.top();
+	if (due > now) {
+	  cv.wait_until(lk, due);
+	  continue;
+	}
+	sched.pop();
+	if (wr->removed || (seq != wr->sched_seq)) {
+	  continue;
+	}
+	uint64_t fence = wr->fence_req;
+	if (fence == wr->fence_done) {
+	  /* fences are not rate-limited */
+	  auto wait = take_token();
+	  if (wait > clock::duration::zero()) {
+	    schedule(wr, now + wait);
+	    continue;
+	  }
+	}
+	lk.unlock();
+	uint32_t cost{0};
+	bool hot = check(*wr, fence != wr->fence_done, cost);
+	lk.lock();
+	charge(cost);
+	++n_checks;
+	wr->interval = hot ? min_interval :
+	  std::min(max_interval, wr->interval * 2);
+	if (fence != wr->fence_done) {
+	  wr->fence_done = fence;
+	  cv.notify_all();
+	}
+	if (! wr->removed) {
+	  schedule(wr, clock::now() + wr->interval);
+	}
+      }
+    } /* ev_loop */
+
+    Pollnotify(Notifiable* n, const std::string& bucket_root)
+      : Notify(n, bucket_root)
+      {
+	thrd = std::thread(&Pollnotify::ev_loop, this);
+      }
+
+    friend class Notify;
+    friend class Hybrid;
+  public:
+#ifdef linux
+    /* true if bucket_root is on a filesystem that doesn't deliver inotify
+     * events for changes made elsewhere */
+    static bool required(const std::string& bucket_root) {
+#ifndef FUSE_SUPER_MAGIC
+#define FUSE_SUPER_MAGIC 0x65735546
+#endif
+#ifndef CIFS_SUPER_MAGIC
+#define CIFS_SUPER_MAGIC 0xFF534D42
+#endif
+#ifndef SMB2_SUPER_MAGIC
+#define SMB2_SUPER_MAGIC 0xFE534D42
+#endif
+      struct statfs sfs;
+      if (statfs(bucket_root.c_str(), &sfs) == -1) {
+	return false;
+      }
+      switch (sfs.f_type) {
+      case NFS_SUPER_MAGIC:
+      case FUSE_SUPER_MAGIC:
+      case SMB_SUPER_MAGIC:
+      case CIFS_SUPER_MAGIC:
+      case SMB2_SUPER_MAGIC:
+      case CEPH_SUPER_MAGIC:
+      case V9FS_MAGIC:
+	return true;
+      default:
+	break;
+      }
+      return false;
+    }
+#endif /* linux */
+
+    void set_stat_rate(uint32_t rate) {
+      stat_rate = std::max(rate, uint32_t(1));
+    }
+
+    virtual int add_watch(const std::string& dname, void* opaque) override {
+      auto wr = std::make_shared<WatchRecord>(dname, opaque);
+      struct stat st;
+      sf::path dp{rp / dname};
+      /* stat before the first scan, so a change during it is seen */
+      if (stat(dp.c_str(), &st) == -1) {
+	std::cerr << fmt::format("{} stat {} failed with {}", __func__, dname, errno) << std::endl;
+	return -1;
+      }
+      wr->mtime = st.st_mtim;
+      wr->ctime = st.st_ctim;
+      uint32_t cost{0};
+      try {
+	wr->snap = scan(*wr, cost);
+      } catch (const sf::filesystem_error& e) {
+	std::cerr << fmt::format("{} scan {} failed with {}", __func__, dname, e.what()) << std::endl;
+	return -1;
+      }
+      std::unique_lock lk{mtx};
+      charge(cost);
+      auto [it, inserted] = watches.try_emplace(dname, wr);
+      if (! inserted) {
+	it->second->removed = true;
+	it->second = wr;
+      }
+      schedule(wr, clock::now() + wr->interval);
+      cv.notify_all();
+      return 0;
+    }
+
+    virtual int remove_watch(const std::string& dname) override {
+      return remove_watch_if(dname, nullptr);
+    }
+
+    /* if opaque is given, only while dname's watch still carries it */
+    int remove_watch_if(const std::string& dname, void* opaque) {
+      std::unique_lock lk{mtx};
+      const auto& elt = watches.find(dname);
+      if ((elt != watches.end()) &&
+	  ((! opaque) || (elt->second->opaque == opaque))) {
+	elt->second->removed = true;
+	watches.erase(elt);
+      }
+      return 0;
+    }
+
+    /* there is no queue to drain, so a fence forces an immediate check
+     * and diff of dname */
+    virtual int fence(const std::string& dname,
+		      std::chrono::steady_clock::time_point deadline) override {
+      std::unique_lock lk{mtx};
+      const auto& elt = watches.find(dname);
+      if (elt == watches.end()) {
+	return 0;
+      }
+      wr_ptr wr = elt->second;
+      uint64_t f = wr->fence_req = ++fence_seq;
+      schedule(wr, clock::now());
+      cv.notify_all();
+      if (! cv.wait_until(lk, deadline, [&wr, f]{
+	    return wr->removed || (wr->fence_done >= f); })) {
+	return -ETIMEDOUT;
+      }
+      return 0;
+    }
+
+    virtual Counts counts() override {
+      Counts c;
+      std::unique_lock lk{mtx};
+      c.polled = watches.size();
+      c.checks = n_checks;
+      return c;
+    }
+
+    virtual ~Pollnotify() {
+      {
+	std::unique_lock lk{mtx};
+	shutdown = true;
+      }
+      cv.notify_all();
+      thrd.join();
+    }
+  }; /* Pollnotify */
+
+#ifdef linux
+  /* a watch budget manager: the hottest buckets, by decayed listing rate,
+   * hold real inotify watches, up to a budget; every other bucket is
+   * polled; a periodic rebalance promotes and demotes buckets between the
+   * tiers as their heat changes, and a failed inotify_add_watch falls
+   * back to polling rather than leaving the bucket unwatched */
+  class Hybrid : public Notify
+  {
+    using clock = std::chrono::steady_clock;
+
+    static constexpr std::chrono::seconds half_life{60};
+    static constexpr std::chrono::seconds rebalance_interval{1};
+    static constexpr std::chrono::seconds transfer_timeout{5};
+    static constexpr uint32_t max_transfers = 256; /* per rebalance */
+
+    class WatchRecord
+    {
+    public:
+      void* opaque;
+      uint64_t id;
+      double heat{1};
+      clock::time_point stamp;
+      bool watched{false};
+      bool moving{false};
+    public:
+      WatchRecord(void* opaque, uint64_t id, clock::time_point stamp) noexcept
+	: opaque(opaque), id(id), stamp(stamp)
+	{}
+
+      double heat_at(clock::time_point now) const {
+	return heat * std::exp2(-std::chrono::duration<double>(now - stamp) /
+				std::chrono::duration<double>(half_life));
+      }
+    }; /* WatchRecord */
+
+    std::unique_ptr<Inotify> in;
+    std::unique_ptr<Pollnotify> pn;
+    std::thread thrd;
+    std::mutex mtx;
+    std::condition_variable cv;
+    ankerl::unordered_dense::map<std::string, WatchRecord> watches;
+    uint64_t next_id{0};
+    uint32_t budget;
+    uint32_t nwatched{0};
+    uint64_t promoted{0};
+    uint64_t demoted{0};
+    bool shutdown{false};
+
+    /* the tiers key watches by name, so a watch's stale entries are told
+     * from its replacement's by opaque; one re-added with the same opaque
+     * can't be told apart, and may keep a duplicate in the other tier
+     * until it next moves or is removed */
+    void unwatch(const std::string& dname, void* opaque, bool watched) {
+      (void) (watched ? in->remove_watch_if(dname, opaque)
+		      : pn->remove_watch_if(dname, opaque));
+    }
+
+    /* after a transfer, drop the tier entry it left (watched, or polled)
+     * if the watch was removed or replaced meanwhile */
+    void settle(const std::string& dname, void* opaque, uint64_t id,
+		bool watched) {
+      std::unique_lock lk{mtx};
+      const auto& elt = watches.find(dname);
+      if ((elt == watches.end()) || (elt->second.id != id)) {
+	bool replaced = (elt != watches.end()) && (elt->second.opaque == opaque);
+	lk.unlock();
+	if (! replaced) {
+	  unwatch(dname, opaque, watched);
+	}
+	return;
+      }
+      auto& wr = elt->second;
+      wr.moving = false;
+      if (wr.watched != watched) {
+	wr.watched = watched;
+	if (watched) {
+	  ++nwatched;
+	  ++promoted;
+	} else {
+	  --nwatched;
+	  ++demoted;
+	}
+      }
+    }
+
+    void demote(const std::string& dname, void* opaque, uint64_t id) {
+      /* the poll snapshot is taken first, then inotify events queued
+       * before it are drained, so nothing falls between the tiers */
+      if (pn->add_watch(dname, opaque) == -1) {
+	settle(dname, opaque, id, true);
+	return;
+      }
+      (void) in->fence(dname, clock::now() + transfer_timeout);
+      (void) in->remove_watch_if(dname, opaque);
+      settle(dname, opaque, id, false);
+    }
+
+    void promote(const std::string& dname, void* opaque, uint64_t id) {
+      /* the watch is set first, then a forced diff catches changes made
+       * since the last poll */
+      if (in->add_watch(dname, opaque) == -1) {
+	settle(dname, opaque, id, false);
+	return;
+      }
+      (void) pn->fence(dname, clock::now() + transfer_timeout);
+      (void) pn->remove_watch_if(dname, opaque);
+      settle(dname, opaque, id, true);
+    }
+
+    void rebalance() {
+      using transfer_t = std::tuple<std::string, void*, uint64_t>;
+      std::vector<transfer_t> demotions, promotions;
+      {
+	std::unique_lock lk{mtx};
+	auto now = clock::now();
+	std::vector<std::pair<double, decltype(watches)::value_type*>> heats;
+	heats.reserve(watches.size());
+	for (auto& elt : watches) {
+	  if (! elt.second.moving) {
+	    heats.push_back({elt.second.heat_at(now), &elt});
+	  }
+	}
+	/* the budget goes to the hottest buckets */
+	uint32_t nhot = std::min(size_t(budget), heats.size());
+	std::nth_element(heats.begin(), heats.begin() + nhot, heats.end(),
+			 [](const auto& l, const auto& r) { return l.first > r.first; });
+	for (uint32_t ix = 0; ix < heats.size(); ++ix) {
+	  auto& [k, wr] = *(heats[ix].second);
+	  bool hot = ix < nhot;
+	  if (hot && (! wr.watched) && (promotions.size() < max_transfers)) {
+	    wr.moving = true;
+	    promotions.push_back(transfer_t(k, wr.opaque, wr.id));
+	  } else if ((! hot) && wr.watched && (demotions.size() < max_transfers)) {
+	    wr.moving = true;
+	    demotions.push_back(transfer_t(k, wr.opaque, wr.id));
+	  }
+	}
+      }
+      /* demote first, to free watches for the promotions */
+      for (const auto& [dname, opaque, id] : demotions) {
+	demote(dname, opaque, id);
+      }
+      for (const auto& [dname, opaque, id] : promotions) {
+	promote(dname, opaque, id);
+      }
+    } /* rebalance */
+
+    void ev_loop() {
+      std::unique_lock lk{mtx};
+      while (! shutdown) {
+	cv.wait_for(lk, rebalance_interval);
+	if (shutdown) {
+	  return;
+	}
+	lk.unlock();
+	rebalance();
+	lk.lock();
+      }
+    } /* ev_loop */
+
+    static uint32_t default_budget() {
+      /* leave half the per-user limit to everyone else */
+      uint32_t max_user_watches{16384};
+      std::ifstream ifs{"/proc/sys/fs/inotify/max_user_watches"};
+      ifs >> max_user_watches;
+      return std::max(max_user_watches / 2, uint32_t(1));
+    }
+
+    Hybrid(Notifiable* n, const std::string& bucket_root, uint32_t budget,
+	   Inotify* in, Pollnotify* pn)
+      : Notify(n, bucket_root), in(in), pn(pn),
+	budget(budget ? budget : default_budget())
+      {
+	thrd = std::thread(&Hybrid::ev_loop, this);
+      }
+
+    friend class Notify;
+  public:
+    void set_watch_budget(uint32_t _budget) {
+      std::unique_lock lk{mtx};
+      budget = _budget;
+    }
+
+    virtual int add_watch(const std::string& dname, void* opaque) override {
+      std::unique_lock lk{mtx};
+      uint64_t id = ++next_id;
+      const auto& old = watches.find(dname);
+      if ((old != watches.end()) && old->second.watched) {
+	--nwatched;
+      }
+      auto [it, inserted] = watches.insert_or_assign(
+	dname, WatchRecord(opaque, id, clock::now()));
+      /* the slot is reserved before the lock is dropped, so concurrent
+       * adds can't all see room and overrun the budget */
+      bool watch = (nwatched < budget);
+      if (watch) {
+	++nwatched;
+      }
+      it->second.watched = watch;
+      it->second.moving = true;
+      lk.unlock();
+      int r{-1};
+      bool watched{false};
+      if (watch) {
+	r = in->add_watch(dname, opaque);
+	watched = (r != -1);
+      }
+      if (! watched) {
+	r = pn->add_watch(dname, opaque);
+      }
+      lk.lock();
+      const auto& elt = watches.find(dname);
+      if ((elt == watches.end()) || (elt->second.id != id)) {
+	/* removed or replaced meanwhile, which gave back any slot */
+	bool replaced = (elt != watches.end()) && (elt->second.opaque == opaque);
+	lk.unlock();
+	if (! replaced) {
+	  unwatch(dname, opaque, watched);
+	}
+	return r;
+      }
+      elt->second.moving = false;
+      if (watch && (! watched)) {
+	elt->second.watched = false;
+	--nwatched;
+      }
+      return r;
+    }
+
+    /* the root is always kernel-watched, outside the budget */
+    virtual int watch_root(void* opaque) override {
+      int r = in->watch_root(opaque);
+      if (r == -1) {
+	r = pn->watch_root(opaque);
+      }
+      return r;
+    }
+
+    virtual int remove_watch(const std::string& dname) override {
+      std::unique_lock lk{mtx};
+      const auto& elt = watches.find(dname);
+      if (elt != watches.end()) {
+	if (elt->second.watched) {
+	  --nwatched;
+	}
+	watches.erase(elt);
+      }
+      lk.unlock();
+      /* a transfer in flight may have the watch in either tier */
+      (void) in->remove_watch(dname);
+      (void) pn->remove_watch(dname);
+      return 0;
+    }
+
+    virtual int fence(const std::string& dname,
+		      std::chrono::steady_clock::time_point deadline) override {
+      int r = in->fence(dname, deadline);
+      if (r == 0) {
+	r = pn->fence(dname, deadline);
+      }
+      return r;
+    }
+
+    virtual void touch(const std::string& dname) override {
+      std::unique_lock lk{mtx};
+      const auto& elt = watches.find(dname);
+      if (elt != watches.end()) {
+	auto& wr = elt->second;
+	auto now = clock::now();
+	wr.heat = wr.heat_at(now) + 1;
+	wr.stamp = now;
+      }
+    }
+
+    virtual Counts counts() override {
+      Counts c;
+      std::unique_lock lk{mtx};
+      c.watched = nwatched;
+      c.polled = watches.size() - nwatched;
+      c.promoted = promoted;
+      c.demoted = demoted;
+      c.overflows = in->counts().overflows;
+      c.checks = pn->counts().checks;
+      return c;
+    }
+
+    virtual ~Hybrid() {
+      {
+	std::unique_lock lk{mtx};
+	shutdown = true;
+      }
+      cv.notify_all();
+      thrd.join();
+    }
+  }; /* Hybrid */
 #endif /* linux */
 
 } // namespace file::listing
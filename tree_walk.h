@@ -0,0 +1,330 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab ft=cpp
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <semaphore>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+#include <cerrno>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+namespace file::listing {
+
+  namespace sf = std::filesystem;
+
+  /* lists a bucket directory for fill: in recursive mode every object
+   * below it, by path relative to it; the subdirectories are read by a
+   * pool of scanners, each working depth-first from its own deque and
+   * stealing the oldest (shallowest, so largest) directory from another's
+   * when it runs dry, which hides per-directory latency on remote
+   * filesystems; each scanner keeps a sorted run, and the runs are merged
+   * so the keys can be appended to lmdb in order; the scanners past the
+   * caller's own run on a Pool's threads, kept by the owner across walks */
+  class TreeWalk
+  {
+  public:
+    struct Config
+    {
+      uint32_t threads{1}; /* scanners */
+      uint32_t max_inflight{0}; /* directory reads at once, 0 for threads */
+      bool with_stat{false}; /* fill in Entry size and mtime */
+    };
+
+    struct Entry
+    {
+      std::string key;
+      uint64_t size{0};
+      int64_t mtime{0}; /* ns */
+
+      Entry(std::string&& key) noexcept
+	: key(std::move(key))
+	{}
+
+      bool operator<(const Entry& rhs) const {
+	return key < rhs.key;
+      }
+    };
+
+  private:
+    struct Scanner
+    {
+      std::mutex mtx;
+      std::deque<std::string> q; /* directories, relative to top */
+      std::vector<Entry> run;
+    };
+
+    const sf::path& top;
+    bool recursive;
+    bool with_stat;
+    std::vector<std::unique_ptr<Scanner>> scanners;
+    std::counting_semaphore<> inflight;
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::atomic<int64_t> pending{0}; /* directories queued or being read */
+    std::atomic<int64_t> queued{0}; /* directories queued (under their Scanner::mtx) */
+    uint32_t running{0}; /* scanners on Pool threads (Pool::mtx) */
+
+    TreeWalk(const sf::path& top, bool recursive, const Config& cfg)
+      : top(top), recursive(recursive), with_stat(cfg.with_stat),
+	inflight(std::max(cfg.max_inflight ? cfg.max_inflight : cfg.threads, 1U))
+      {
+	for (uint32_t ix = 0; ix < std::max(cfg.threads, 1U); ++ix) {
+	  scanners.push_back(std::make_unique<Scanner>());
+	}
+      }
+
+    void push(Scanner& s, std::string&& dir) {
+      ++pending;
+      {
+	std::lock_guard guard{s.mtx};
+	s.q.push_back(std::move(dir));
+	++queued;
+      }
+      /* under mtx, so a scanner between its check and its wait can't
+       * miss it */
+      std::lock_guard guard{mtx};
+      cv.notify_one();
+    }
+
+    /* own work newest first, others' oldest first */
+    bool next(uint32_t ix, std::string& dir) {
+      {
+	auto& s = *scanners[ix];
+	std::lock_guard guard{s.mtx};
+	if (! s.q.empty()) {
+	  dir = std::move(s.q.back());
+	  s.q.pop_back();
+	  --queued;
+	  return true;
+	}
+      }
+      for (uint32_t off = 1; off < scanners.size(); ++off) {
+	auto& v = *scanners[(ix + off) % scanners.size()];
+	std::lock_guard guard{v.mtx};
+	if (! v.q.empty()) {
+	  dir = std::move(v.q.front());
+	  v.q.pop_front();
+	  --queued;
+	  return true;
+	}
+      }
+      return false;
+    }
+
+    /* returns 0 or -errno */
+    int read_dir(Scanner& s, const std::string& dir) {
+      sf::path dp{dir.empty() ? top : (top / dir)};
+      inflight.acquire();
+      DIR* d = opendir(dp.c_str());
+      if (! d) {
+	int r = -errno;
+	inflight.release();
+	return r;
+      }
+      struct dirent* de;
+      while ((de = readdir(d))) {
+	if ((de->d_name[0] == '.') &&
+	    ((de->d_name[1] == '\0') ||
+	     ((de->d_name[1] == '.') && (de->d_name[2] == '\0')))) {
+	  continue;
+	}
+	std::string key = dir.empty() ? std::string(de->d_name) :
+	  (dir + "/" + de->d_name);
+	/* at most one fstatat per name, on the open directory */
+	struct stat st;
+	bool statted{false};
+	if (recursive) {
+	  bool isdir = (de->d_type == DT_DIR);
+	  if (de->d_type == DT_UNKNOWN) {
+	    statted = (fstatat(dirfd(d), de->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0);
+	    isdir = statted && S_ISDIR(st.st_mode);
+	  }
+	  if (isdir) {
+	    push(s, std::move(key));
+	    continue;
+	  }
+	}
+	auto& e = s.run.emplace_back(std::move(key));
+	if (with_stat &&
+	    (statted ||
+	     (fstatat(dirfd(d), de->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0))) {
+	  e.size = st.st_size;
+	  e.mtime = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+	}
+      }
+      closedir(d);
+      inflight.release();
+      return 0;
+    }
+
+    void scan(uint32_t ix) {
+      auto& s = *scanners[ix];
+      std::string dir;
+      for (;;) {
+	if (next(ix, dir)) {
+	  /* a subdirectory gone meanwhile took its objects with it */
+	  (void) read_dir(s, dir);
+	  if (--pending == 0) {
+	    std::lock_guard guard{mtx};
+	    cv.notify_all();
+	  }
+	  continue;
+	}
+	std::unique_lock lk{mtx};
+	cv.wait(lk, [this] { return (pending == 0) || (queued > 0); });
+	if (pending == 0) {
+	  break;
+	}
+      }
+      std::sort(s.run.begin(), s.run.end());
+    }
+
+    void merge(std::vector<Entry>& keys) {
+      using head_t = std::tuple<const Entry*, uint32_t, size_t>;
+      const auto later = [](const head_t& l, const head_t& r) {
+	return *get<0>(r) < *get<0>(l);
+      };
+      std::priority_queue<head_t, std::vector<head_t>, decltype(later)> heads(later);
+      size_t n{0};
+      for (uint32_t ix = 0; ix < scanners.size(); ++ix) {
+	auto& run = scanners[ix]->run;
+	n += run.size();
+	if (! run.empty()) {
+	  heads.push(head_t(&run[0], ix, 0));
+	}
+      }
+      keys.reserve(keys.size() + n);
+      while (! heads.empty()) {
+	auto [k, ix, pos] = heads.top();
+	heads.pop();
+	auto& run = scanners[ix]->run;
+	keys.push_back(std::move(run[pos]));
+	if (++pos < run.size()) {
+	  heads.push(head_t(&run[pos], ix, pos));
+	}
+      }
+    }
+
+  public:
+    /* threads running the scanners of walks, other than each caller's
+     * own; started as walks first need them, up to the most scanners any
+     * walk has asked for less one, and kept until shutdown; a walk's
+     * scanners still queued when it has finished are withdrawn, so walks
+     * sharing too few threads are slowed, never stalled */
+    class Pool
+    {
+      struct Job
+      {
+	TreeWalk* tw;
+	uint32_t ix; /* scanner */
+      };
+
+      std::mutex mtx;
+      std::condition_variable cv; /* jobs queued, or stop */
+      std::condition_variable done_cv; /* a job finished */
+      std::deque<Job> jobs;
+      std::vector<std::thread> thrds;
+      bool stop{false};
+
+      void run() {
+	std::unique_lock lk{mtx};
+	for (;;) {
+	  cv.wait(lk, [this] { return stop || ! jobs.empty(); });
+	  if (stop) {
+	    return;
+	  }
+	  Job job = jobs.front();
+	  jobs.pop_front();
+	  ++job.tw->running;
+	  lk.unlock();
+	  job.tw->scan(job.ix);
+	  lk.lock();
+	  --job.tw->running;
+	  done_cv.notify_all();
+	}
+      }
+
+    public:
+      ~Pool() {
+	shutdown();
+      }
+
+      /* stops and joins the threads; walks after it run on their
+       * callers alone */
+      void shutdown() {
+	{
+	  std::lock_guard guard{mtx};
+	  stop = true;
+	}
+	cv.notify_all();
+	for (auto& thrd : thrds) {
+	  thrd.join();
+	}
+	thrds.clear();
+      }
+
+      /* queues tw's scanners past the first */
+      void post(TreeWalk* tw) {
+	uint32_t n = tw->scanners.size();
+	{
+	  std::lock_guard guard{mtx};
+	  if (stop) {
+	    return;
+	  }
+	  while (thrds.size() < (n - 1)) {
+	    thrds.emplace_back(&Pool::run, this);
+	  }
+	  for (uint32_t ix = 1; ix < n; ++ix) {
+	    jobs.push_back(Job{tw, ix});
+	  }
+	}
+	cv.notify_all();
+      }
+
+      /* withdraws tw's scanners not yet started, and waits out the rest */
+      void retire(TreeWalk* tw) {
+	std::unique_lock lk{mtx};
+	std::erase_if(jobs, [tw](const Job& job) { return job.tw == tw; });
+	done_cv.wait(lk, [tw] { return tw->running == 0; });
+      }
+    }; /* Pool */
+
+    /* the entries of top in ascending (byte) order of key, as lmdb orders
+     * them; returns 0, or -errno if top itself can't be read */
+    static int walk(Pool& pool, const sf::path& top, bool recursive,
+		    const Config& cfg, std::vector<Entry>& keys) {
+      TreeWalk tw(top, recursive, cfg);
+      /* the top directory inline, so its failure is the walk's */
+      ++tw.pending;
+      int r = tw.read_dir(*tw.scanners[0], std::string());
+      --tw.pending;
+      if (r != 0) {
+	return r;
+      }
+      if (tw.pending > 0) {
+	pool.post(&tw);
+	tw.scan(0);
+	pool.retire(&tw);
+      } else {
+	auto& run = tw.scanners[0]->run;
+	std::sort(run.begin(), run.end());
+      }
+      tw.merge(keys);
+      return 0;
+    }
+  }; /* TreeWalk */
+
+} // namespace file::listing